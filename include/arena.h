@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stddef.h>
+
+// A bump allocator. Everything pushed onto an arena is released at once by
+// arena_reset() or arena_free(); nothing is freed individually.
+struct arena_block {
+	struct arena_block* next;
+	size_t size;
+	char data[];
+};
+
+struct arena {
+	struct arena_block* blocks;
+	char* cur;
+	char* end;
+	// bytes taken from malloc over the arena's life, for reports
+	size_t allocated;
+};
+
+struct arena* arena_alloc();
+void arena_free(struct arena*);
+void arena_reset(struct arena*);
+
+void* arena_push(struct arena*, size_t);
+void* arena_resize(struct arena*, void*, size_t, size_t);
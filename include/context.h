@@ -0,0 +1,92 @@
+#pragma once
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "arena.h"
+#include "intern.h"
+#include "source.h"
+#include "tc.h"
+#include "token.h"
+#include "trace.h"
+#include "vec.h"
+
+struct ir_func;
+struct lex_pipe;
+
+// Everything a single compilation reads and writes. Nothing is shared
+// between contexts, so each one can run on its own thread.
+struct tc_context {
+	struct tc_options options;
+
+	// Files
+	const char* input_filename;
+	struct source* input_source;
+	const char* output_filename;
+	FILE* output_file;
+
+	// Arenas for the token stream, the root scope, the tree of the function
+	// being compiled and the identifiers
+	struct arena* lex_arena;
+	struct arena* parse_arena;
+	struct arena* func_arena;
+	struct arena* ident_arena;
+
+	// Lexer, reading the input between 'start' and 'end'
+	const char* start;
+	const char* cur;
+	const char* end;
+	// asm blocks held back while the parser catches up, if any
+	struct vec* asm_blocks;
+	int asm_next;
+	// the lexer thread, when lexing runs ahead on one
+	struct lex_pipe* pipe;
+	// names are left for the caller to intern, when lexing a part of the
+	// input on another thread
+	bool intern_later;
+
+	// Identifiers, in an open addressing table
+	struct ident** ident_table;
+	int ident_capacity;
+	int ident_count;
+
+	// Parser, allocating the tree from 'arena'
+	struct arena* arena;
+	struct tokens* tokens;
+	int current_token;
+	int current_value;
+	int string_count;
+	// tree nodes and symbols made, for the time report
+	long node_count;
+	long sym_count;
+	// Root symbols a function body may use when bodies are parsed out of
+	// order, the strings it has used and the functions it has called so
+	// far, and the arenas the workers parsed into
+	int root_visible;
+	struct vec* strings;
+	struct vec* calls;
+	struct arena** worker_arenas;
+	int worker_arena_count;
+
+	// Code generator, building each function's IR in 'gen_arena'
+	struct arena* gen_arena;
+	struct ir_func* ir;
+
+	// Output held back while functions are generated in parallel, with
+	// the file it all goes to in the end
+	struct vec* gen_chunks;
+	FILE* gen_file;
+
+	// Time report: the time charged to each phase so far, and the phase
+	// running on this thread and when it started
+	struct trace_time phase_times[PHASE_COUNT];
+	int phase;
+	struct trace_time phase_start;
+
+	// Errors unwind back to tc_compile() through 'on_error'
+	jmp_buf on_error;
+	char error[512];
+};
+
+_Noreturn void tc_verror(struct tc_context*, int, const char*, va_list);
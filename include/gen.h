@@ -4,6 +4,12 @@
 
 #include "parser.h"
 
-int gen_expr(struct expr*, struct symtable*);
-void gen_stmt(struct stmt*, struct symtable*);
-void gen(struct lib*);
+int gen_expr(struct tc_context*, struct expr*);
+void gen_stmt(struct tc_context*, struct stmt*);
+void gen_func(struct tc_context*, struct func*);
+void gen(struct tc_context*, struct lib*);
+
+void gen_begin(struct tc_context*);
+void gen_queue(struct tc_context*, struct func*);
+void gen_flush(struct tc_context*, int);
+void gen_release(struct tc_context*);
@@ -0,0 +1,15 @@
+#pragma once
+
+// An identifier, stored once no matter how many times it appears. Two
+// identifiers are the same name if and only if their pointers are equal.
+struct ident {
+	int id;
+	int length;
+	unsigned int hash;
+	char name[];
+};
+
+struct tc_context;
+
+struct ident* intern_get(struct tc_context*, const char*, int);
+int intern_count(struct tc_context*);
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "arena.h"
+#include "parser.h"
+#include "vec.h"
+
+// A function in three-address form. Every value lives in a virtual
+// register, numbered from 0, and each instruction reads at most two of
+// them and writes at most one. Instructions are grouped into basic blocks
+// that are only entered at the top and end in exactly one terminator.
+//
+// Locals and parameters can't have their address taken, so each gets a
+// virtual register of its own for the whole function instead of a place in
+// the frame. Those are the only registers written more than once.
+
+enum ir_op {
+	// dst <- imm
+	IR_IMM,
+	// dst <- &string number 'imm'
+	IR_STRING,
+	// dst <- (type) a, dst <- a
+	IR_CAST, IR_MOV,
+	// dst <- parameter number 'imm', only at the top of the function
+	IR_PARAM,
+
+	// dst <- sym, sym <- a
+	IR_LOAD_VAR, IR_STORE_VAR,
+	// dst <- *a, *a <- b, of 'type'
+	IR_LOAD, IR_STORE,
+
+	// dst <- a op b
+	IR_ADD, IR_SUB, IR_MUL, IR_DIV,
+	IR_AND, IR_OR, IR_SHL, IR_SHR,
+	// dst <- a op b, as 0 or 1
+	IR_EQ, IR_NE, IR_LT, IR_GT, IR_LE, IR_GE,
+
+	// dst <- sym(args...)
+	IR_CALL,
+
+	// Terminators: goto target, if a goto target else other, return a
+	// (or nothing if a < 0)
+	IR_JMP, IR_BR, IR_RET,
+};
+
+struct ir_block;
+
+struct ir_instr {
+	enum ir_op op;
+	int type;
+	// virtual registers, or -1 when not used
+	int dst;
+	int a, b;
+	long imm;
+	struct sym* sym;
+	// IR_CALL
+	int* args;
+	int arg_count;
+	// IR_JMP, IR_BR
+	struct ir_block* target;
+	struct ir_block* other;
+};
+
+struct ir_block {
+	// position in the function's layout, once placed
+	int index;
+	struct vec* instrs;
+};
+
+struct ir_func {
+	struct func* func;
+	struct arena* arena;
+	// blocks in the order they are laid out
+	struct vec* blocks;
+	// the block being added to, or NULL after a terminator
+	struct ir_block* block;
+	int reg_count;
+	int instr_count;
+	// the registers of locals, by offset in the frame, or -1 until used
+	int* vars;
+};
+
+static inline bool ir_isterm(enum ir_op op) { return op >= IR_JMP; }
+static inline bool ir_iscmp(enum ir_op op) { return op >= IR_EQ && op <= IR_GE; }
+
+struct ir_func* ir_func_alloc(struct arena*, struct func*);
+struct ir_block* ir_block_alloc(struct ir_func*);
+void ir_start(struct ir_func*, struct ir_block*);
+int ir_reg(struct ir_func*);
+int ir_var(struct ir_func*, struct sym*);
+
+struct ir_instr* ir_emit(struct ir_func*, enum ir_op, int, int, int);
+void ir_jump(struct ir_func*, struct ir_block*);
+void ir_branch(struct ir_func*, int, struct ir_block*, struct ir_block*);
+void ir_prune(struct ir_func*);
@@ -2,6 +2,16 @@
 
 #include <stdio.h>
 
+#include "token.h"
 #include "vec.h"
 
-struct vec* lex();
+struct tc_context;
+
+void lex_token(struct tc_context*, struct token*);
+struct tokens* lex(struct tc_context*, struct arena*);
+struct tokens* lex_stream(struct tc_context*, struct arena*, int);
+struct tokens* lex_parallel(struct tc_context*, struct arena*, int);
+struct tokens* lex_pipe(struct tc_context*, struct arena*, int);
+void lex_pipe_stop(struct tc_context*);
+char* lex_getstring(struct tc_context*, int, int, struct arena*);
+void lex_flush_asm(struct tc_context*, int);
@@ -1,8 +1,13 @@
 #pragma once
 
+#include "arena.h"
+#include "sym.h"
+#include "token.h"
 #include "type.h"
 #include "vec.h"
 
+struct tc_context;
+
 enum expr_type {
 	EXPR_NUMBER, EXPR_STRING, EXPR_NAME,
 	EXPR_CALL, EXPR_CAST,
@@ -20,20 +25,29 @@ enum expr_type {
 };
 struct expr {
 	enum expr_type expr_type;
-	struct expr* parent;
 	int type;
-
-	long number;
-	char* name;
-	struct expr* unop;
-	struct {
-		struct expr* call;
-		struct vec* args;
-	} call;
-	struct {
-		struct expr* left;
-		struct expr* right;
-	} binop;
+	// registers needed to evaluate it, by Sethi-Ullman numbering, and
+	// whether it calls or assigns anything. set by gen_label()
+	short regs;
+	bool effects;
+	union {
+		// EXPR_NUMBER
+		long number;
+		// EXPR_NAME, EXPR_STRING
+		struct sym* sym;
+		// EXPR_CAST, EXPR_DEREF
+		struct expr* unop;
+		// EXPR_CALL, one argument per parameter of 'func'
+		struct {
+			struct sym* func;
+			struct expr** args;
+		} call;
+		// Binary
+		struct {
+			struct expr* left;
+			struct expr* right;
+		} binop;
+	};
 };
 
 enum stmt_type {
@@ -76,26 +90,38 @@ struct lib {
 	struct vec* funcs;
 };
 
-int    parse_type();
-struct expr* parse_primary_expr(struct symtable*);
-struct expr* parse_postfix_expr(struct symtable*);
-struct expr* parse_unary_expr(struct symtable*);
-struct expr* parse_cast_expr(struct symtable*);
-struct expr* parse_mul_expr(struct symtable*);
-struct expr* parse_add_expr(struct symtable*);
-struct expr* parse_shift_expr(struct symtable*);
-struct expr* parse_rel_expr(struct symtable*);
-struct expr* parse_eq_expr(struct symtable*);
-struct expr* parse_assign_expr(struct symtable*);
-struct expr* parse_expr(struct symtable*);
-struct stmt* parse_compound_stmt(struct symtable*);
-struct stmt* parse_sel_stmt(struct symtable*);
-struct stmt* parse_iter_stmt(struct symtable*);
-struct stmt* parse_jump_stmt(struct symtable*);
-struct stmt* parse_decl_stmt(struct symtable*);
-struct stmt* parse_expr_stmt(struct symtable*);
-struct stmt* parse_stmt(struct symtable*);
-void         parse_ext_func(struct symtable*);
-struct func* parse_func(struct symtable*);
+int    parse_type(struct tc_context*);
+struct expr* parse_primary_expr(struct tc_context*, struct symtable*);
+struct expr* parse_postfix_expr(struct tc_context*, struct symtable*);
+struct expr* parse_unary_expr(struct tc_context*, struct symtable*);
+struct expr* parse_cast_expr(struct tc_context*, struct symtable*);
+struct expr* parse_mul_expr(struct tc_context*, struct symtable*);
+struct expr* parse_add_expr(struct tc_context*, struct symtable*);
+struct expr* parse_shift_expr(struct tc_context*, struct symtable*);
+struct expr* parse_rel_expr(struct tc_context*, struct symtable*);
+struct expr* parse_eq_expr(struct tc_context*, struct symtable*);
+struct expr* parse_assign_expr(struct tc_context*, struct symtable*);
+struct expr* parse_expr(struct tc_context*, struct symtable*);
+struct stmt* parse_compound_stmt(struct tc_context*, struct symtable*);
+struct stmt* parse_sel_stmt(struct tc_context*, struct symtable*);
+struct stmt* parse_iter_stmt(struct tc_context*, struct symtable*);
+struct stmt* parse_jump_stmt(struct tc_context*, struct symtable*);
+struct stmt* parse_decl_stmt(struct tc_context*, struct symtable*);
+struct stmt* parse_expr_stmt(struct tc_context*, struct symtable*);
+struct stmt* parse_stmt(struct tc_context*, struct symtable*);
+void         parse_ext_func(struct tc_context*, struct symtable*);
+struct func* parse_func(struct tc_context*, struct symtable*);
+
+// How far past the current token the parser looks, and so how many tokens
+// a stream needs to keep: the lookahead, the current one and the previous
+// one for diagnostics
+#define PARSE_LOOKAHEAD 1
+#define PARSE_WINDOW (PARSE_LOOKAHEAD + 2)
 
-struct lib*  parse(struct vec*);
+struct lib*  parse(struct tc_context*, struct tokens*, struct arena*);
+struct lib*  parse_stream(struct tc_context*, struct tokens*, struct arena*, struct arena*,
+		void (*)(struct tc_context*, struct func*));
+struct lib*  parse_parallel(struct tc_context*, struct tokens*, struct arena*, int,
+		void (*)(struct tc_context*, struct func*));
+struct lib*  parse_lazy(struct tc_context*, struct tokens*, struct arena*, int, const char**,
+		void (*)(struct tc_context*, struct func*));
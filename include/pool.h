@@ -0,0 +1,7 @@
+#pragma once
+
+// Runs 'work(arg)' on 'threads' threads at once, the calling one included,
+// and returns once they have all finished. Workers share 'arg' and usually
+// take jobs off it until there are none left. Returns the CPU time, in
+// seconds, used by the threads other than the calling one.
+double pool_run(int threads, void* (*work)(void*), void* arg);
@@ -0,0 +1,15 @@
+#pragma once
+
+// Scanning kernels for the lexer. Each one returns the first byte in
+// [p, end) that stops the run it skips, or 'end'. The implementation is
+// picked once at startup from what the CPU supports: AVX2, SSE2 or plain
+// byte-at-a-time loops.
+
+// first byte that isn't ' ', '\t', '\n' or '\r'
+extern const char* (*scan_space)(const char*, const char*);
+// first byte that isn't a letter, a digit or '_'
+extern const char* (*scan_word)(const char*, const char*);
+// first '/' or '*', the only bytes that matter inside a block comment
+extern const char* (*scan_comment)(const char*, const char*);
+// first '\n'
+extern const char* (*scan_line)(const char*, const char*);
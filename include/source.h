@@ -0,0 +1,21 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+
+struct source {
+	char* data;
+	int size;
+	bool mapped;
+
+	// Offsets of the first character of each line, built on first use by
+	// whichever thread gets there first
+	int* lines;
+	int line_count;
+	pthread_mutex_t lines_lock;
+};
+
+struct source* source_open(const char*);
+void source_close(struct source*);
+
+void source_getpos(struct source*, int, int*, int*);
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "arena.h"
+#include "intern.h"
 #include "type.h"
 
 enum sym_type {
@@ -8,8 +10,11 @@ enum sym_type {
 struct sym {
 	enum sym_type sym_type;
 	int type;
+	struct ident* ident;
 	char* name;
 	int offset;
+	// position in the scope it was put in
+	int index;
 
 	int param_count;
 	int param_capacity;
@@ -17,20 +22,32 @@ struct sym {
 };
 
 struct symtable {
+	struct arena* arena;
 	struct symtable* parent;
 	struct vec* syms;
+
+	// Open addressing index over 'syms' by identifier, only built once the
+	// scope grows past a few symbols
+	struct sym** buckets;
+	int bucket_count;
+
+	// Lowest stack offset taken by this scope and its parents so far, and
+	// the function scope whose frame holds them
+	int offset;
+	struct symtable* frame;
+	int frame_size;
 };
 
 // Sym
-struct sym* sym_alloc(enum sym_type);
-void sym_add_param(struct sym*, int);
+struct sym* sym_alloc(struct arena*, enum sym_type);
+void sym_add_param(struct arena*, struct sym*, int);
 
 void sym_put(struct symtable*, struct sym*);
-struct sym* sym_get(struct symtable*, const char*);
-int sym_get_last_offset(struct symtable*);
+void sym_put_local(struct symtable*, struct sym*);
+struct sym* sym_get(struct symtable*, struct ident*);
 
 // Symtable
-struct symtable* symtable_alloc(struct symtable*);
-void symtable_free(struct symtable*);
+struct symtable* symtable_alloc(struct arena*, struct symtable*);
+struct symtable* symtable_alloc_frame(struct arena*, struct symtable*);
 
 struct symtable* symtable_get_root(struct symtable*);
@@ -0,0 +1,47 @@
+#pragma once
+
+// The compiler as a library. A context holds all the state of one
+// compilation at a time and can be reused for the next one. Different
+// contexts can be used from different threads at once.
+#include <stdio.h>
+
+struct tc_context;
+
+// A file of Chrome trace events, which any number of contexts can write to
+// at once
+struct tc_trace;
+
+struct tc_options {
+	// Threads to generate the code for a file's functions on. With 1, each
+	// function is generated as soon as it is parsed and then thrown away
+	int gen_threads;
+	// Threads to parse a file's function bodies on. With more than 1 the
+	// whole file is lexed before parsing starts
+	int parse_threads;
+	// Threads to lex a file on, split into parts. With more than 1 the
+	// whole file is lexed before parsing starts
+	int lex_threads;
+	// Lex on a thread of its own, ahead of the parser, when the file isn't
+	// parsed on several threads
+	int lex_thread;
+	// Only parse and generate the functions reachable from 'main' and from
+	// those named in 'roots', a NULL terminated list, through the calls
+	// they make. The whole file is lexed before parsing starts
+	int lazy;
+	const char** roots;
+	// Where to write how long each phase of a compilation took, and how
+	// much it made, or NULL
+	FILE* time_report;
+	// Where to trace the parsing and code generation of each function, or
+	// NULL
+	struct tc_trace* trace;
+};
+
+struct tc_context* tc_alloc(const struct tc_options*);
+void tc_free(struct tc_context*);
+
+int tc_compile(struct tc_context*, const char*, const char*);
+const char* tc_geterror(struct tc_context*);
+
+struct tc_trace* tc_trace_open(const char*);
+int tc_trace_close(struct tc_trace*);
@@ -1,11 +1,15 @@
 #pragma once
 
+#include <stdbool.h>
+
+#include "arena.h"
+#include "intern.h"
 #include "type.h"
 
 enum {
 	T_EXTERN = 127, T_VAR, T_FN, T_RETURN,
 	T_IF, T_ELSE, T_WHILE,
-	T_SIZEOF,
+	T_SIZEOF, T_ASM,
 
 	T_SHR_ASSIGN, T_SHL_ASSIGN, T_ADD_ASSIGN, T_SUB_ASSIGN,
 	T_MUL_ASSIGN, T_DIV_ASSIGN, T_AND_ASSIGN, T_OR_ASSIGN,
@@ -15,16 +19,83 @@ enum {
 	T_NUMBER, T_STRING, T_TYPE, T_NAME, T_EOF,
 };
 
+union token_value {
+	long number;
+	int type;
+	struct ident* ident;
+	// T_STRING, the length of the literal including its quotes
+	int length;
+};
+
 struct token {
-	int line, line_index;
+	int offset, length;
 	int token;
 	union {
 		long number;
 		int type;
-		char* name;
+		struct ident* ident;
 	};
 };
 
+struct tc_context;
+
+// A stream of tokens kept as parallel arrays: a kind and a source offset
+// per token, plus a side table holding, in order, the value of every token
+// that has one.
+//
+// Either the arrays hold the whole stream and the masks are -1, or they are
+// ring buffers that only keep the last few tokens, indexed by position &
+// mask, and 'pull' lexes more as the reader gets to them.
+struct tokens {
+	struct arena* arena;
+	unsigned char* kinds;
+	int* offsets;
+	int count;
+	int capacity;
+	int mask;
+
+	union token_value* values;
+	int value_count;
+	int value_capacity;
+	int value_mask;
+
+	void (*pull)(struct tc_context*, struct token*);
+	struct tc_context* ctx;
+};
+
+static inline bool token_hasvalue(int kind) {
+	return kind >= T_NUMBER && kind <= T_NAME;
+}
+
 int token_type_fromstr(const char*);
+int token_type_fromword(const char*, int, int*);
 const char* token_type_tostr(int);
 const char* token_tostr(struct token*);
+
+struct tokens* tokens_alloc(struct arena*);
+struct tokens* tokens_alloc_ring(struct arena*, int, void (*)(struct tc_context*, struct token*),
+		struct tc_context*);
+void tokens_push(struct tokens*, struct token*);
+
+// makes sure the token at position 'i' has been read into 'ts'
+static inline void tokens_need(struct tokens* ts, int i) {
+	while (i >= ts->count) {
+		struct token t;
+		ts->pull(ts->ctx, &t);
+		tokens_push(ts, &t);
+	}
+}
+
+static inline int tokens_kind(struct tokens* ts, int i) {
+	tokens_need(ts, i);
+	return ts->kinds[i & ts->mask];
+}
+
+static inline int tokens_offset(struct tokens* ts, int i) {
+	tokens_need(ts, i);
+	return ts->offsets[i & ts->mask];
+}
+
+static inline union token_value tokens_value(struct tokens* ts, int i) {
+	return ts->values[i & ts->value_mask];
+}
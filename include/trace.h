@@ -0,0 +1,26 @@
+#pragma once
+
+struct tc_context;
+
+// Phases the time report splits a compilation into. Only one runs at a
+// time on the compiling thread; PHASE_COUNT is none of them
+enum {
+	PHASE_OTHER, PHASE_LEX, PHASE_PARSE, PHASE_GEN, PHASE_COUNT,
+};
+
+// Wall and CPU time of the calling thread, in seconds
+struct trace_time {
+	double wall;
+	double cpu;
+};
+
+void trace_now(struct trace_time*);
+
+// Time report
+int  trace_switch(struct tc_context*, int);
+void trace_cpu(struct tc_context*, double);
+void trace_report(struct tc_context*);
+
+// Trace events
+void trace_begin(struct tc_context*, struct trace_time*);
+void trace_end(struct tc_context*, struct trace_time*, const char*, const char*);
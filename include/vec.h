@@ -2,10 +2,13 @@
 
 #include <stdbool.h>
 
+#include "arena.h"
+
 struct vec {
 	void** data;
 	int capacity;
 	int size;
+	struct arena* arena;
 };
 
 struct iterator {
@@ -13,6 +16,6 @@ struct iterator {
 	int index;
 };
 
-struct vec *vec_alloc();
+struct vec *vec_alloc(struct arena*);
 void vec_free(struct vec*);
 void vec_push(struct vec*, void*);
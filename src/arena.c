@@ -0,0 +1,73 @@
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define BLOCK_SIZE (64 * 1024)
+#define ALIGN(n) (((n) + 7) & ~(size_t) 7)
+
+struct arena* arena_alloc() {
+	struct arena* a = malloc(sizeof(struct arena));
+	a->blocks = NULL;
+	a->cur = a->end = NULL;
+	a->allocated = 0;
+	return a;
+}
+
+void arena_free(struct arena* a) {
+	while (a->blocks != NULL) {
+		struct arena_block* b = a->blocks;
+		a->blocks = b->next;
+		free(b);
+	}
+	free(a);
+}
+
+// releases everything pushed onto 'a', keeping its first block around so
+// the next phase doesn't have to go back to malloc.
+void arena_reset(struct arena* a) {
+	if (a->blocks == NULL)
+		return;
+	while (a->blocks->next != NULL) {
+		struct arena_block* b = a->blocks;
+		a->blocks = b->next;
+		free(b);
+	}
+	a->cur = a->blocks->data;
+	a->end = a->blocks->data + a->blocks->size;
+}
+
+static void arena_grow(struct arena* a, size_t size) {
+	if (size < BLOCK_SIZE)
+		size = BLOCK_SIZE;
+	struct arena_block* b = malloc(sizeof(struct arena_block) + size);
+	b->size = size;
+	b->next = a->blocks;
+	a->allocated += size;
+	a->blocks = b;
+	a->cur = b->data;
+	a->end = b->data + size;
+}
+
+void* arena_push(struct arena* a, size_t size) {
+	size = ALIGN(size);
+	if ((size_t) (a->end - a->cur) < size)
+		arena_grow(a, size);
+	void* p = a->cur;
+	a->cur += size;
+	return p;
+}
+
+// grows 'p' from 'old_size' to 'new_size' bytes, in place when it was the
+// last thing pushed and there is room, otherwise by copying.
+void* arena_resize(struct arena* a, void* p, size_t old_size, size_t new_size) {
+	if (p != NULL && (char*) p + ALIGN(old_size) == a->cur &&
+			(size_t) (a->end - (char*) p) >= ALIGN(new_size)) {
+		a->cur = (char*) p + ALIGN(new_size);
+		return p;
+	}
+	void* n = arena_push(a, new_size);
+	if (p != NULL)
+		memcpy(n, p, old_size < new_size ? old_size : new_size);
+	return n;
+}
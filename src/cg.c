@@ -1,48 +1,40 @@
 #include "cg.h"
 
 #include <stdarg.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "context.h"
 #include "sym.h"
 
-extern FILE* output_file;
-
 /*
  * Utilities
  */
 // halt and catch fire
-static int error(const char* format, ...) {
+static _Noreturn int error(struct tc_context* ctx, const char* format, ...) {
 	va_list args;
 	va_start(args, format);
-	printf("cg error: ");
-	vprintf(format, args);
-	va_end(args);
-	exit(1);
-	return -1;
+	tc_verror(ctx, -1, format, args);
 }
 
-static void out(const char* format, ...) {
+static void out(struct tc_context* ctx, const char* format, ...) {
 	va_list args;
 	va_start(args, format);
-	vfprintf(output_file, format, args);
+	vfprintf(ctx->output_file, format, args);
 	va_end(args);
 }
 
-static char* cg_get_load_instr(int type) {
-	if (type_getsize(type) == 8) return "mov";
-	else return type_issigned(type) ? "movsx" : "movzx";
-}
-
-static char* cg_get_size(int type) {
+static char* cg_get_size(struct tc_context* ctx, int type) {
 	switch (type_getsize(type)) {
 		case 1: return "byte";
 		case 2: return "word";
 		case 4: return "dword";
 		case 8: return "qword";
 		default:
-			error("cg_get_size: invalid type %d.\n", type);
+			error(ctx, "cg_get_size: invalid type %d.\n", type);
 			return NULL;
 	}
 }
@@ -50,444 +42,974 @@ static char* cg_get_size(int type) {
 /*
  * Registers
  */
-#define REG_COUNT 8
-static int reg_used[REG_COUNT] = { 0 };
-static char* reg64[] = { "r10",  "r11",  "r12",  "r13",  "r14",  "r15",  "rax", "rbx" };
-static char* reg32[] = { "r10d", "r11d", "r12d", "r13d", "r14d", "r15d", "eax", "ebx" };
-static char* reg16[] = { "r10w", "r11w", "r12w", "r13w", "r14w", "r15w", "ax",  "bx" };
-static char* reg8[] =  { "r10b", "r11b", "r12b", "r13b", "r14b", "r15b", "al",  "bl" };
+enum { RAX, RCX, RDX, RBX, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+static char* reg64[] = { "rax", "rcx", "rdx", "rbx", "rsi", "rdi", "r8",  "r9",
+	"r10",  "r11",  "r12",  "r13",  "r14",  "r15" };
+static char* reg32[] = { "eax", "ecx", "edx", "ebx", "esi", "edi", "r8d", "r9d",
+	"r10d", "r11d", "r12d", "r13d", "r14d", "r15d" };
+static char* reg16[] = { "ax",  "cx",  "dx",  "bx",  "si",  "di",  "r8w", "r9w",
+	"r10w", "r11w", "r12w", "r13w", "r14w", "r15w" };
+static char* reg8[] =  { "al",  "cl",  "dl",  "bl",  "sil", "dil", "r8b", "r9b",
+	"r10b", "r11b", "r12b", "r13b", "r14b", "r15b" };
 
 #define ARG_REG_COUNT 6
-static char* arg_reg64[] = { "rdi", "rsi", "rdx", "rcx", "r8",  "r9" };
-static char* arg_reg32[] = { "edi", "esi", "edx", "ecx", "r8d", "r9d" };
+static const int arg_regs[] = { RDI, RSI, RDX, RCX, R8, R9 };
 
-// returns the name of the register 'r' when storing a value of type 'type'
-// from it.
-static char* cg_get_reg_name(int r, int type) {
+// returns the name of the register 'r' holding a value of type 'type'
+static char* cg_get_reg_name(struct tc_context* ctx, int r, int type) {
 	switch (type_getsize(type)) {
 		case 1: return reg8[r];
 		case 2: return reg16[r];
 		case 4: return reg32[r];
 		case 8: return reg64[r];
 		default:
-			error("cg_get_reg_name: invalid type %d.\n", type);
+			error(ctx, "cg_get_reg_name: invalid type %d.\n", type);
 			return NULL;
 	}
 }
 
-// returns the name of the register 'r' when loading a value of type 'type'
-// into it.
-static char* cg_get_reg_load_name(int r, int type) {
-	return type == TYPE_32 ? reg32[r] : reg64[r];
-}
+/*
+ * Allocation
+ */
+// Registers values are kept in, cheapest first. The caller-saved ones cost
+// nothing to use but don't survive calls, the callee-saved ones have to be
+// kept by the prologue. r10 and r11 are left over as scratch for operands
+// in memory
+#define ALLOC_COUNT 12
+static const int alloc_order[] = { RSI, RDI, R8, R9, RDX, RCX, RAX, RBX, R12, R13, R14, R15 };
+#define SCRATCH1 R11
+#define SCRATCH2 R10
+
+static bool cg_callee_saved(int r) {
+	return r == RBX || r >= R12;
+}
+
+// Where the function's virtual registers live, worked out before any code
+// is written since the prologue needs to know the size of the frame
+struct cg_func {
+	struct ir_func* ir;
+	// per virtual register: its live interval, over positions where the
+	// n-th instruction reads its operands at 2n and writes its result at
+	// 2n + 1, how often it is used and written, the instruction first
+	// defining it and the register it would rather be in
+	int* start;
+	int* end;
+	int* uses;
+	int* writes;
+	struct ir_instr** defs;
+	int* hint;
+	// and where it lives: a register, a slot in the frame when negative, or
+	// LOC_IMM. 'names' is the operand for any of them
+	int* loc;
+	char** names;
+	// positions writing fixed registers: calls, divisions and shifts
+	int* calls;
+	int* divs;
+	int* shifts;
+	int call_count;
+	int div_count;
+	int shift_count;
+	// the first instruction of each block, and the blocks something
+	// branches to, which need a label
+	int* block_first;
+	bool* targeted;
+	// callee-saved registers in use and the frame slots they are kept in
+	unsigned saved;
+	int save_offset[R15 + 1];
+	int frame_size;
+};
+
+// where a folded constant lives
+#define LOC_IMM INT_MIN
+
+static void cg_use(struct cg_func* cg, int v, int pos) {
+	if (2 * pos > cg->end[v])
+		cg->end[v] = 2 * pos;
+	cg->uses[v]++;
+}
+
+// numbers the instructions in layout order, recording where each virtual
+// register is defined and used within its block, what it would like to be
+// in, and which fixed registers get overwritten where
+static void cg_scan(struct cg_func* cg) {
+	struct ir_func* ir = cg->ir;
+	int pos = 0;
+	for (int bi = 0; bi < ir->blocks->size; bi++) {
+		struct ir_block* b = ir->blocks->data[bi];
+		cg->block_first[bi] = pos;
+		for (int ii = 0; ii < b->instrs->size; ii++, pos++) {
+			struct ir_instr* i = b->instrs->data[ii];
+			if (i->a >= 0)
+				cg_use(cg, i->a, pos);
+			if (i->b >= 0)
+				cg_use(cg, i->b, pos);
+			for (int k = 0; k < i->arg_count; k++) {
+				cg_use(cg, i->args[k], pos);
+				if (k < ARG_REG_COUNT && cg->hint[i->args[k]] < 0)
+					cg->hint[i->args[k]] = arg_regs[k];
+			}
+			if (i->dst >= 0) {
+				if (cg->defs[i->dst] == NULL) {
+					cg->defs[i->dst] = i;
+					cg->start[i->dst] = 2 * pos + 1;
+				}
+				if (2 * pos + 1 > cg->end[i->dst])
+					cg->end[i->dst] = 2 * pos + 1;
+				cg->writes[i->dst]++;
+			}
+
+			switch (i->op) {
+				case IR_PARAM:
+					// parameters are all taken at once, see cg_params()
+					cg->start[i->dst] = 1;
+					if (i->imm < ARG_REG_COUNT)
+						cg->hint[i->dst] = arg_regs[i->imm];
+					break;
+				case IR_CALL:
+					cg->calls[cg->call_count++] = 2 * pos + 1;
+					cg->hint[i->dst] = RAX;
+					break;
+				case IR_DIV:
+					cg->divs[cg->div_count++] = 2 * pos + 1;
+					cg->hint[i->dst] = RAX;
+					if (cg->hint[i->a] < 0)
+						cg->hint[i->a] = RAX;
+					break;
+				case IR_SHL: case IR_SHR:
+					cg->shifts[cg->shift_count++] = 2 * pos + 1;
+					break;
+				case IR_RET:
+					if (i->a >= 0 && cg->hint[i->a] < 0)
+						cg->hint[i->a] = RAX;
+					break;
+				default:
+					break;
+			}
+		}
 
-int cg_reg_alloc() {
-	int r = 0;
-	int ru = 10000000;
-	for (int i = 0; i < REG_COUNT; i++) {
-		if (reg_used[i] < ru) {
-			ru = reg_used[i];
-			r = i;
+		// the jumps written at the end of the block, see cg_branch()
+		struct ir_instr* last = b->instrs->data[b->instrs->size - 1];
+		if (last->op == IR_JMP && last->target->index != bi + 1) {
+			cg->targeted[last->target->index] = true;
+		} else if (last->op == IR_BR) {
+			if (last->other->index != bi + 1)
+				cg->targeted[last->other->index] = true;
+			if (last->other->index == bi + 1 || last->target->index != bi + 1)
+				cg->targeted[last->target->index] = true;
 		}
 	}
-	if (reg_used[r]++ > 0) {
-		out("\tpush\t%s\n", reg64[r]);
-	}
-	return r;
 }
 
-void cg_reg_free(int r) {
-	if (reg_used[r] == 0) {
-		printf("Attempting to free already free'd register %s.\n", reg64[r]);
-	} else if (--reg_used[r] > 0) {
-		out("\tpop\t%s\n", reg64[r]);
+#define WORD_BITS 64
+#define BIT_TEST(set, i) ((set)[(i) / WORD_BITS] >> ((i) % WORD_BITS) & 1)
+#define BIT_SET(set, i) ((set)[(i) / WORD_BITS] |= 1UL << ((i) % WORD_BITS))
+
+// Values used outside the block defining them are live along every path
+// from a definition to a use, found by the usual backward dataflow over
+// just those values. Their intervals are stretched over every block they
+// are live in
+static void cg_liveness(struct cg_func* cg) {
+	struct ir_func* ir = cg->ir;
+	struct arena* a = ir->arena;
+	int blocks = ir->blocks->size;
+
+	// a use that isn't preceded by a definition in the same block
+	int* global = arena_push(a, ir->reg_count * sizeof(int));
+	int* seen = arena_push(a, ir->reg_count * sizeof(int));
+	int* vars = arena_push(a, ir->reg_count * sizeof(int));
+	int count = 0;
+	memset(global, -1, ir->reg_count * sizeof(int));
+	memset(seen, -1, ir->reg_count * sizeof(int));
+	for (int bi = 0; bi < blocks; bi++) {
+		struct ir_block* b = ir->blocks->data[bi];
+		for (int ii = 0; ii < b->instrs->size; ii++) {
+			struct ir_instr* i = b->instrs->data[ii];
+			int reads[2] = { i->a, i->b };
+			for (int k = 0; k < 2; k++) {
+				int v = reads[k];
+				if (v >= 0 && seen[v] != bi && global[v] < 0) {
+					global[v] = count;
+					vars[count++] = v;
+				}
+			}
+			for (int k = 0; k < i->arg_count; k++) {
+				int v = i->args[k];
+				if (seen[v] != bi && global[v] < 0) {
+					global[v] = count;
+					vars[count++] = v;
+				}
+			}
+			if (i->dst >= 0)
+				seen[i->dst] = bi;
+		}
 	}
-}
-
-void cg_reg_free_all() {
-	for (int i = 0; i < REG_COUNT; i++) {
-		while (--reg_used[i] > 0) {
-			out("\tpop\t%s\n", reg64[i]);
+	if (count == 0)
+		return;
+
+	int words = (count + WORD_BITS - 1) / WORD_BITS;
+	size_t size = (size_t) blocks * words * sizeof(unsigned long);
+	unsigned long* use = arena_push(a, 4 * size);
+	unsigned long* def = use + blocks * words;
+	unsigned long* in = def + blocks * words;
+	unsigned long* out = in + blocks * words;
+	memset(use, 0, 4 * size);
+	for (int bi = 0; bi < blocks; bi++) {
+		struct ir_block* b = ir->blocks->data[bi];
+		unsigned long* u = use + bi * words;
+		unsigned long* d = def + bi * words;
+		for (int ii = 0; ii < b->instrs->size; ii++) {
+			struct ir_instr* i = b->instrs->data[ii];
+			int reads[2] = { i->a, i->b };
+			for (int k = 0; k < 2; k++) {
+				if (reads[k] >= 0 && global[reads[k]] >= 0 && !BIT_TEST(d, global[reads[k]]))
+					BIT_SET(u, global[reads[k]]);
+			}
+			for (int k = 0; k < i->arg_count; k++) {
+				int g = global[i->args[k]];
+				if (g >= 0 && !BIT_TEST(d, g))
+					BIT_SET(u, g);
+			}
+			if (i->dst >= 0 && global[i->dst] >= 0)
+				BIT_SET(d, global[i->dst]);
 		}
-		reg_used[i] = 0;
 	}
-}
 
-void cg_reg_push_used() {
-	for (int i = 0; i < REG_COUNT; i++) {
-		if (reg_used[i] > 0) {
-			out("\tpush\t%s\n", reg64[i]);
+	// blocks are laid out roughly in order, so going backwards settles
+	// in a few rounds
+	for (bool changed = true; changed;) {
+		changed = false;
+		for (int bi = blocks - 1; bi >= 0; bi--) {
+			struct ir_block* b = ir->blocks->data[bi];
+			struct ir_instr* last = b->instrs->data[b->instrs->size - 1];
+			unsigned long* o = out + bi * words;
+			struct ir_block* succs[2] = { last->target, last->other };
+			for (int k = 0; k < 2; k++) {
+				if (succs[k] == NULL)
+					continue;
+				unsigned long* s = in + succs[k]->index * words;
+				for (int w = 0; w < words; w++)
+					o[w] |= s[w];
+			}
+			unsigned long* n = in + bi * words;
+			unsigned long* u = use + bi * words;
+			unsigned long* d = def + bi * words;
+			for (int w = 0; w < words; w++) {
+				unsigned long x = u[w] | (o[w] & ~d[w]);
+				if (x != n[w]) {
+					n[w] = x;
+					changed = true;
+				}
+			}
 		}
 	}
-}
 
-void cg_reg_pop_used() {
-	for (int i = REG_COUNT - 1; i >= 0; i--) {
-		if (reg_used[i] > 0) {
-			out("\tpop\t%s\n", reg64[i]);
+	for (int bi = 0; bi < blocks; bi++) {
+		struct ir_block* b = ir->blocks->data[bi];
+		int first = 2 * cg->block_first[bi];
+		int last = 2 * (cg->block_first[bi] + b->instrs->size - 1) + 1;
+		for (int g = 0; g < count; g++) {
+			int v = vars[g];
+			if (BIT_TEST(in + bi * words, g)) {
+				if (first < cg->start[v])
+					cg->start[v] = first;
+				if (first > cg->end[v])
+					cg->end[v] = first;
+			}
+			if (BIT_TEST(out + bi * words, g) && last > cg->end[v])
+				cg->end[v] = last;
 		}
 	}
 }
 
-
-/*
- * Declarations
- */
-int cg_new_label() {
-	static int label_count = 0;
-	return label_count++;
+// Constants only used once, as the second operand of an instruction that
+// can take an immediate, become that immediate rather than taking a
+// register
+static bool cg_takes_imm(enum ir_op op) {
+	return (op >= IR_ADD && op <= IR_SHR && op != IR_DIV) || ir_iscmp(op);
 }
 
-void cg_decl_label(int label) {
-	out("L%d:\n", label);
+static bool cg_reads(struct ir_instr* i, int v) {
+	if (i->a == v || i->b == v)
+		return true;
+	for (int k = 0; k < i->arg_count; k++) {
+		if (i->args[k] == v)
+			return true;
+	}
+	return false;
+}
+
+static void cg_fold_imms(struct cg_func* cg) {
+	struct ir_func* ir = cg->ir;
+	for (int bi = 0; bi < ir->blocks->size; bi++) {
+		struct ir_block* b = ir->blocks->data[bi];
+		for (int ii = 0; ii < b->instrs->size; ii++) {
+			struct ir_instr* i = b->instrs->data[ii];
+			if (i->op != IR_IMM || cg->uses[i->dst] != 1 || cg->writes[i->dst] != 1 || i->imm < -0x80000000L || i->imm > 0x7fffffffL)
+				continue;
+			// the value is used within its block, so the use is found by
+			// looking ahead
+			for (int k = ii + 1; k < b->instrs->size; k++) {
+				struct ir_instr* u = b->instrs->data[k];
+				if (u->b == i->dst && u->a != i->dst && cg_takes_imm(u->op)) {
+					cg->loc[i->dst] = LOC_IMM;
+					cg->names[i->dst] = arena_push(ir->arena, 24);
+					snprintf(cg->names[i->dst], 24, "%ld", i->imm);
+					break;
+				}
+				if (cg_reads(u, i->dst))
+					break;
+			}
+		}
+	}
 }
 
-void cg_decl_global(struct sym* s) {
-	out("%s ", s->name);
-	switch (type_getsize(s->type)) {
-		case 1: out("db 0\n"); break;
-		case 2: out("dw 0\n"); break;
-		case 4: out("dd 0\n"); break;
-		case 8: out("dq 0\n"); break;
-		default:
-			error("cg_decl_global\n");
-			break;
+// whether any of the sorted positions 'ps' falls in (start, end]
+static bool cg_crosses(int* ps, int n, int start, int end) {
+	int lo = 0, hi = n;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (ps[mid] <= start)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo < n && ps[lo] <= end;
+}
+
+// whether 'r' can hold 'v' for its whole interval, without an instruction
+// in between writing over it
+static bool cg_fits(struct cg_func* cg, int r, int v) {
+	int start = cg->start[v], end = cg->end[v];
+	if (!cg_callee_saved(r) && cg_crosses(cg->calls, cg->call_count, start, end))
+		return false;
+	if ((r == RAX || r == RDX) && cg_crosses(cg->divs, cg->div_count, start, end))
+		return false;
+	if (r == RCX && cg_crosses(cg->shifts, cg->shift_count, start, end))
+		return false;
+	return true;
+}
+
+// picks a free register for 'v': the one it was asked to be in, the one
+// its first operand just gave up, which suits two-address instructions, or
+// the cheapest
+static int cg_pick(struct cg_func* cg, int v, unsigned busy) {
+	if (cg->hint[v] >= 0 && !(busy & (1u << cg->hint[v])) && cg_fits(cg, cg->hint[v], v))
+		return cg->hint[v];
+	struct ir_instr* d = cg->defs[v];
+	if (d != NULL && d->a >= 0 && cg->loc[d->a] >= 0 && !(busy & (1u << cg->loc[d->a])) && cg_fits(cg, cg->loc[d->a], v))
+		return cg->loc[d->a];
+	for (int k = 0; k < ALLOC_COUNT; k++) {
+		if (!(busy & (1u << alloc_order[k])) && cg_fits(cg, alloc_order[k], v))
+			return alloc_order[k];
 	}
+	return -1;
 }
 
-void cg_decl_string(struct sym* s) {
-	out("LC%d: db ", s->offset);
-	for (char* str = s->name; *str; str++)
-		out("%d, ", *str);
-	out("0\n");
-}
+static int compare_long(const void* a, const void* b) {
+	long x = *(const long*) a, y = *(const long*) b;
+	return x < y ? -1 : x > y;
+}
+
+// puts 'v' in the frame, in a slot nothing else is using over its interval
+static void cg_spill(struct cg_func* cg, int v, int* slot_end, int* slots) {
+	int k = 0;
+	while (k < *slots && slot_end[k] >= cg->start[v])
+		k++;
+	if (k == *slots)
+		(*slots)++;
+	if (cg->end[v] > slot_end[k])
+		slot_end[k] = cg->end[v];
+	cg->loc[v] = -8 * (k + 1);
+}
+
+// Linear scan: intervals are handed registers in the order they start,
+// and take them back once they end. When there is none to spare, whichever
+// interval ends last goes to the frame, since that frees a register for
+// longest
+static void cg_allocate(struct cg_func* cg) {
+	struct ir_func* ir = cg->ir;
+	struct arena* a = ir->arena;
+	long* order = arena_push(a, ir->reg_count * sizeof(long));
+	int count = 0;
+	for (int v = 0; v < ir->reg_count; v++) {
+		// a local read before it is ever written still needs a place
+		if ((cg->defs[v] != NULL || cg->uses[v] > 0) && cg->loc[v] != LOC_IMM)
+			order[count++] = (long) cg->start[v] << 32 | v;
+	}
+	qsort(order, count, sizeof(long), compare_long);
+
+	int active[ALLOC_COUNT];
+	int active_count = 0;
+	unsigned busy = 0;
+	int* slot_end = arena_push(a, (count + 1) * sizeof(int));
+	memset(slot_end, -1, (count + 1) * sizeof(int));
+	int slots = 0;
+	for (int k = 0; k < count; k++) {
+		int v = order[k] & 0xffffffff;
+		for (int j = 0; j < active_count;) {
+			if (cg->end[active[j]] < cg->start[v]) {
+				busy &= ~(1u << cg->loc[active[j]]);
+				active[j] = active[--active_count];
+			} else {
+				j++;
+			}
+		}
+
+		int r = cg_pick(cg, v, busy);
+		if (r < 0) {
+			int victim = -1;
+			for (int j = 0; j < active_count; j++) {
+				int w = active[j];
+				if (cg->end[w] > cg->end[v] && cg_fits(cg, cg->loc[w], v) &&
+						(victim < 0 || cg->end[w] > cg->end[active[victim]]))
+					victim = j;
+			}
+			if (victim < 0) {
+				cg_spill(cg, v, slot_end, &slots);
+				continue;
+			}
+			r = cg->loc[active[victim]];
+			cg_spill(cg, active[victim], slot_end, &slots);
+			active[victim] = active[--active_count];
+			busy &= ~(1u << r);
+		}
+		cg->loc[v] = r;
+		busy |= 1u << r;
+		active[active_count++] = v;
+		if (cg_callee_saved(r))
+			cg->saved |= 1u << r;
+	}
 
+	for (int k = 0; k < count; k++) {
+		int v = order[k] & 0xffffffff;
+		if (cg->loc[v] >= 0) {
+			cg->names[v] = reg64[cg->loc[v]];
+		} else {
+			cg->names[v] = arena_push(a, 24);
+			snprintf(cg->names[v], 24, "qword [rbp%d]", cg->loc[v]);
+		}
+	}
+
+	// callee-saved registers go below the slots, and the frame is kept
+	// to a multiple of 16 so calls see an aligned stack
+	int size = 8 * slots;
+	for (int r = 0; r <= R15; r++) {
+		if (cg->saved & (1u << r)) {
+			size += 8;
+			cg->save_offset[r] = -size;
+		}
+	}
+	cg->frame_size = (size + 15) & ~15;
+}
 
 /*
- * Branching
+ * Moves
  */
-void cg_jmp(int label) {
-	out("\tjmp L%d\n", label);
+static bool cg_inreg(struct cg_func* cg, int v) {
+	return cg->loc[v] >= 0;
 }
 
-void cg_jmp_if_false(int label, int r) {
-	out("\ttest %s, %s\n", reg64[r], reg64[r]);
-	out("\tjz L%d\n", label);
+// register 'r' <- 'v'
+static void cg_load(struct tc_context* ctx, struct cg_func* cg, int r, int v) {
+	if (cg->loc[v] != r)
+		out(ctx, "\tmov %s, %s\n", reg64[r], cg->names[v]);
 }
 
-void cg_push_arg(int i, int r) {
-	if (i < ARG_REG_COUNT) {
-		out("\tmov %s, %s\n", arg_reg64[i], reg64[r]);
-	} else {
-		out("\tpush %s\n", reg64[r]);
-	}
+// 'v' <- register 'r'
+static void cg_store(struct tc_context* ctx, struct cg_func* cg, int v, int r) {
+	if (cg->loc[v] != r)
+		out(ctx, "\tmov %s, %s\n", cg->names[v], reg64[r]);
 }
 
-int cg_call(const char* name) {
-	out("\tcall %s\n", name);
-	cg_reg_pop_used();
-	int r = cg_reg_alloc();
-	out("\tmov %s, rax\n", reg64[r]);
-	return r;
+// returns the register holding 'v', moving it into 'scratch' first if it
+// lives in memory
+static int cg_reg(struct tc_context* ctx, struct cg_func* cg, int v, int scratch) {
+	if (cg_inreg(cg, v))
+		return cg->loc[v];
+	cg_load(ctx, cg, scratch, v);
+	return scratch;
 }
 
-void cg_ret(int r) {
-	out("\tmov rax, %s\n", r < 0 ? "0" : reg64[r]);
-	out("\tleave\n");
-	out("\tret\n");
+// returns the register to compute 'v' in: its own, or 'scratch' if it
+// lives in memory, to be stored afterwards with cg_store()
+static int cg_target(struct cg_func* cg, int v, int scratch) {
+	return cg_inreg(cg, v) ? cg->loc[v] : scratch;
 }
 
-/*
- * Load (something into a register)
- */
-// register <- number
-int cg_load_number(int number) {
-	int r = cg_reg_alloc();
-	out("\tmov %s, %d\n", reg64[r], number);
-	return r;
-}
-
-// register <- &string
-int cg_load_string(int label) {
-	int r = cg_reg_alloc();
-	out("\tmov %s, LC%d\n", reg64[r], label);
-	return r;
-}
-
-// register <- variable
-int cg_load_name(const char* name, struct symtable* st) {
-	struct sym* s = sym_get(st, name);
-	int r = cg_reg_alloc();
-	if (s->sym_type == SYM_LOCAL) {
-		out("\t%s %s, %s [rbp%d]\n",
-			cg_get_load_instr(s->type),
-			cg_get_reg_load_name(r, s->type),
-			cg_get_size(s->type),
-			s->offset);
-	} else if (s->sym_type == SYM_GLOBAL) {
-		out("\t%s %s, %s [%s]\n",
-			cg_get_load_instr(s->type),
-			cg_get_reg_load_name(r, s->type),
-			cg_get_size(s->type),
-			s->name);
-	} else {
-		return error("cg_load_name: invalid symbol type %d.\n", s->sym_type);
-	}
-	return r;
+// register 'r' <- memory at [base+offset], sign or zero extended from
+// 'type'
+static void cg_load_mem(struct tc_context* ctx, int r, int type, const char* base, int offset) {
+	int size = type_getsize(type);
+	const char* instr = size == 8 ? "mov" : size == 4 ? (type_issigned(type) ? "movsxd" : "mov") :
+		type_issigned(type) ? "movsx" : "movzx";
+	const char* dst = size == 4 && !type_issigned(type) ? reg32[r] : reg64[r];
+	if (offset != 0)
+		out(ctx, "\t%s %s, %s [%s%+d]\n", instr, dst, cg_get_size(ctx, type), base, offset);
+	else
+		out(ctx, "\t%s %s, %s [%s]\n", instr, dst, cg_get_size(ctx, type), base);
 }
 
-// register <- *register
-int cg_load_addr(int r, int type) {
-	out("\t%s %s, %s [%s]\n",
-		cg_get_load_instr(type),
-		cg_get_reg_load_name(r, type),
-		cg_get_size(type),
-		reg64[r]);
-	return r;
+// memory at [base+offset] <- register 'r', truncated to 'type'
+static void cg_store_mem(struct tc_context* ctx, int r, int type, const char* base, int offset) {
+	if (offset != 0)
+		out(ctx, "\tmov %s [%s%+d], %s\n", cg_get_size(ctx, type), base, offset,
+				cg_get_reg_name(ctx, r, type));
+	else
+		out(ctx, "\tmov %s [%s], %s\n", cg_get_size(ctx, type), base,
+				cg_get_reg_name(ctx, r, type));
 }
 
-/*
- * Store (something from a register)
- */
-// variable <- register
-void cg_store_name(int r, const char* name, struct symtable* st) {
-	struct sym* s = sym_get(st, name);
-	if (s->sym_type == SYM_LOCAL) {
-		out("\tmov [rbp%d], %s\n",
-			s->offset,
-			cg_get_reg_name(r, s->type));
-	} else if (s->sym_type == SYM_GLOBAL) {
-		out("\tmov [%s], %s\n",
-			s->name,
-			cg_get_reg_name(r, s->type));
-	} else {
-		error("cg_store_name: invalid symbol type %d.\n", s->sym_type);
+// register 'r' <- (type) register 'r'
+static void cg_extend(struct tc_context* ctx, int r, int type) {
+	switch (type_getsize(type)) {
+		case 1:
+			out(ctx, "\t%s %s, %s\n", type_issigned(type) ? "movsx" : "movzx", reg64[r], reg8[r]);
+			break;
+		case 2:
+			out(ctx, "\t%s %s, %s\n", type_issigned(type) ? "movsx" : "movzx", reg64[r], reg16[r]);
+			break;
+		case 4:
+			if (type_issigned(type))
+				out(ctx, "\tmovsxd %s, %s\n", reg64[r], reg32[r]);
+			else
+				out(ctx, "\tmov %s, %s\n", reg32[r], reg32[r]);
+			break;
 	}
 }
 
-// *register <- register
-void cg_store_addr(int rsrc, int rdest, int type) {
-	out("\tmov [%s], %s\n",
-		reg64[rdest],
-		cg_get_reg_name(rsrc, type));
-}
-
 /*
- * Unary prefix
+ * Instructions
  */
-
-// r <- (type) r
-int cg_cast(int r, int type) {
-	if (type_getsize(type) != 8) {
-		out("\tand %s, %d\n",
-			reg64[r],
-			~(1 << (8 * type_getsize(type))));
+static const char* cg_binop_instr(enum ir_op op) {
+	switch (op) {
+		case IR_ADD: return "add";
+		case IR_SUB: return "sub";
+		case IR_MUL: return "imul";
+		case IR_AND: return "and";
+		case IR_OR: return "or";
+		case IR_SHL: return "shl";
+		case IR_SHR: return "shr";
+		default: return NULL;
 	}
-	return r;
 }
 
-// r <- &variable
-int cg_addrof(const char* name, struct symtable* st) {
-	int r = cg_reg_alloc();
-	struct sym* s = sym_get(st, name);
-	if (s->sym_type == SYM_LOCAL) {
-		out("\tlea %s, [rbp%d]\n", reg64[r], s->offset);
-	} else if (s->sym_type == SYM_GLOBAL) {
-		out("\tlea %s, [%s]\n", reg64[r], s->name);
-	} else {
-		error("cg_addrof: invalid symbol type %d\n", s->sym_type);
+// condition codes for a comparison and for its opposite
+static const char* cg_cond(enum ir_op op, bool negate) {
+	switch (op) {
+		case IR_EQ: return negate ? "ne" : "e";
+		case IR_NE: return negate ? "e" : "ne";
+		case IR_LT: return negate ? "ge" : "l";
+		case IR_GT: return negate ? "le" : "g";
+		case IR_LE: return negate ? "g" : "le";
+		case IR_GE: return negate ? "l" : "ge";
+		default: return NULL;
 	}
-	return r;
 }
 
-/*
- * Binary arithmetic
- */
-// r1 <- r1 + r2
-int cg_add(int r1, int r2) {
-	out("\tadd %s, %s\n", reg64[r1], reg64[r2]);
-	cg_reg_free(r2);
-	return r1;
+static void cg_binop(struct tc_context* ctx, struct cg_func* cg, struct ir_instr* i) {
+	int a = i->a, b = i->b;
+	bool commutes = i->op != IR_SUB;
+	if (commutes && cg->loc[i->dst] == cg->loc[b] && cg->loc[a] != cg->loc[b]) {
+		a = i->b;
+		b = i->a;
+	}
+	int t = cg_target(cg, i->dst, SCRATCH1);
+	// 'b' would be overwritten by 'a' before being read
+	if (cg->loc[b] == t && cg->loc[a] != t)
+		t = SCRATCH1;
+	cg_load(ctx, cg, t, a);
+	out(ctx, "\t%s %s, %s\n", cg_binop_instr(i->op), reg64[t], cg->names[b]);
+	cg_store(ctx, cg, i->dst, t);
+}
+
+// the count goes in cl, so the value is shifted elsewhere when the result
+// or the count lives in rcx
+static void cg_shift(struct tc_context* ctx, struct cg_func* cg, struct ir_instr* i) {
+	if (cg->loc[i->b] == LOC_IMM) {
+		int t = cg_target(cg, i->dst, SCRATCH1);
+		cg_load(ctx, cg, t, i->a);
+		out(ctx, "\t%s %s, %s\n", cg_binop_instr(i->op), reg64[t], cg->names[i->b]);
+		cg_store(ctx, cg, i->dst, t);
+		return;
+	}
+	int t = cg_target(cg, i->dst, SCRATCH1);
+	if (t == RCX || t == cg->loc[i->b])
+		t = SCRATCH1;
+	cg_load(ctx, cg, t, i->a);
+	cg_load(ctx, cg, RCX, i->b);
+	out(ctx, "\t%s %s, cl\n", cg_binop_instr(i->op), reg64[t]);
+	cg_store(ctx, cg, i->dst, t);
+}
+
+// rdx:rax / b, leaving the quotient in rax
+static void cg_div(struct tc_context* ctx, struct cg_func* cg, struct ir_instr* i) {
+	const char* divisor = cg->names[i->b];
+	if (cg->loc[i->b] == RAX || cg->loc[i->b] == RDX) {
+		cg_load(ctx, cg, SCRATCH1, i->b);
+		divisor = reg64[SCRATCH1];
+	}
+	cg_load(ctx, cg, RAX, i->a);
+	out(ctx, "\tcqo\n");
+	out(ctx, "\tidiv %s\n", divisor);
+	cg_store(ctx, cg, i->dst, RAX);
 }
 
-// r1 <- r1 - r2
-int cg_sub(int r1, int r2) {
-	out("\tsub %s, %s\n", reg64[r1], reg64[r2]);
-	cg_reg_free(r2);
-	return r1;
+static void cg_compare(struct tc_context* ctx, struct cg_func* cg, struct ir_instr* i) {
+	out(ctx, "\tcmp %s, %s\n", reg64[cg_reg(ctx, cg, i->a, SCRATCH1)], cg->names[i->b]);
 }
 
-// r1 <- r1 * r2
-int cg_mul(int r1, int r2) {
-	out("\timul %s, %s\n", reg64[r1], reg64[r2]);
-	cg_reg_free(r2);
-	return r1;
+static void cg_label_ref(struct tc_context* ctx, const char* instr, struct ir_block* b) {
+	out(ctx, "\t%s .L%d\n", instr, b->index);
 }
 
-// r1 <- r1 / r2
-int cg_div(int r1, int r2) {
-	if (reg_used[6]++ > 0)
-		out("\tpush rax\n");
-	out("\tmov rax, %s\n", reg64[r1]);
-	out("\tcqo\n");
-	out("\tidiv %s\n", reg64[r2]);
-	out("\tmov %s, rax\n", reg64[r1]);
-	if (--reg_used[6] > 0)
-		out("\tpop rax\n");
-	cg_reg_free(r2);
-	return r1;
+// ends block 'b' with a branch on the flags, taken on 'cond' and falling
+// through on 'negated', leaving out jumps to the next block
+static void cg_branch(struct tc_context* ctx, struct ir_block* b, struct ir_instr* i,
+		const char* cond, const char* negated) {
+	char instr[8];
+	if (i->other->index == b->index + 1) {
+		snprintf(instr, sizeof(instr), "j%s", cond);
+		cg_label_ref(ctx, instr, i->target);
+	} else {
+		snprintf(instr, sizeof(instr), "j%s", negated);
+		cg_label_ref(ctx, instr, i->other);
+		if (i->target->index != b->index + 1)
+			cg_label_ref(ctx, "jmp", i->target);
+	}
 }
 
-// r1 <- r1 & r2
-int cg_and(int r1, int r2) {
-	out("\tand %s, %s\n", reg64[r1], reg64[r2]);
-	cg_reg_free(r2);
-	return r1;
+// Moves 'count' values into place at once, from 'from[k]' to 'to[k]',
+// each a register or a slot in the frame when negative. The moves are
+// ordered so every register is read before it is overwritten, with a cycle
+// broken by setting one of its registers aside in r11
+static void cg_moves(struct tc_context* ctx, struct cg_func* cg, int count, int* to, const char** to_names,
+		int* from, const char** from_names) {
+	bool* pending = arena_push(cg->ir->arena, count * sizeof(bool));
+	int left = 0;
+	for (int k = 0; k < count; k++) {
+		pending[k] = to[k] != from[k];
+		left += pending[k];
+	}
+	while (left > 0) {
+		bool moved = false;
+		for (int k = 0; k < count; k++) {
+			if (!pending[k])
+				continue;
+			bool blocked = false;
+			for (int j = 0; j < count; j++)
+				blocked |= pending[j] && j != k && to[k] >= 0 && from[j] == to[k];
+			if (blocked)
+				continue;
+			const char* src = from[k] >= 0 ? reg64[from[k]] : from_names[k];
+			if (to[k] >= 0) {
+				out(ctx, "\tmov %s, %s\n", reg64[to[k]], src);
+			} else if (from[k] >= 0) {
+				out(ctx, "\tmov %s, %s\n", to_names[k], src);
+			} else {
+				out(ctx, "\tmov %s, %s\n", reg64[SCRATCH1], src);
+				out(ctx, "\tmov %s, %s\n", to_names[k], reg64[SCRATCH1]);
+			}
+			pending[k] = false;
+			left--;
+			moved = true;
+		}
+		if (moved)
+			continue;
+		// only moves between registers are left, each waiting on another
+		for (int k = 0; k < count; k++) {
+			if (!pending[k])
+				continue;
+			out(ctx, "\tmov %s, %s\n", reg64[SCRATCH1], reg64[to[k]]);
+			for (int j = 0; j < count; j++) {
+				if (pending[j] && from[j] == to[k])
+					from[j] = SCRATCH1;
+			}
+			break;
+		}
+	}
 }
 
-// r1 <- r1 | r2
-int cg_or(int r1, int r2) {
-	out("\tor %s, %s\n", reg64[r1], reg64[r2]);
-	cg_reg_free(r2);
-	return r1;
+// Registers aren't kept across calls, as nothing caller-saved is allocated
+// to a value that lives past one
+static void cg_call(struct tc_context* ctx, struct cg_func* cg, struct ir_instr* i) {
+	// arguments past the sixth go on the stack, which has to stay aligned
+	int stack = i->arg_count > ARG_REG_COUNT ? i->arg_count - ARG_REG_COUNT : 0;
+	int pad = stack % 2 ? 8 : 0;
+	if (pad)
+		out(ctx, "\tsub rsp, %d\n", pad);
+	for (int k = i->arg_count - 1; k >= ARG_REG_COUNT; k--)
+		out(ctx, "\tpush %s\n", cg->names[i->args[k]]);
+
+	int to[ARG_REG_COUNT], from[ARG_REG_COUNT];
+	const char* names[ARG_REG_COUNT];
+	int n = i->arg_count - stack;
+	for (int k = 0; k < n; k++) {
+		to[k] = arg_regs[k];
+		from[k] = cg->loc[i->args[k]];
+		names[k] = cg->names[i->args[k]];
+	}
+	cg_moves(ctx, cg, n, to, NULL, from, names);
+
+	out(ctx, "\tcall %s\n", i->sym->name);
+	if (stack * 8 + pad)
+		out(ctx, "\tadd rsp, %d\n", stack * 8 + pad);
+	if (cg->uses[i->dst] > 0)
+		cg_store(ctx, cg, i->dst, RAX);
+}
+
+// takes the 'count' parameters into their registers, from the argument
+// registers or from above the return address
+static void cg_params(struct tc_context* ctx, struct cg_func* cg, struct ir_instr** params, int count) {
+	struct arena* a = cg->ir->arena;
+	int* to = arena_push(a, count * sizeof(int));
+	int* from = arena_push(a, count * sizeof(int));
+	const char** to_names = arena_push(a, count * sizeof(char*));
+	const char** from_names = arena_push(a, count * sizeof(char*));
+	int n = 0;
+	for (int k = 0; k < count; k++) {
+		struct ir_instr* i = params[k];
+		if (cg->uses[i->dst] == 0)
+			continue;
+		to[n] = cg->loc[i->dst];
+		to_names[n] = cg->names[i->dst];
+		if (i->imm < ARG_REG_COUNT) {
+			from[n] = arg_regs[i->imm];
+		} else {
+			char* name = arena_push(a, 32);
+			snprintf(name, 32, "qword [rbp+%ld]", 16 + 8 * (i->imm - ARG_REG_COUNT));
+			from[n] = -1;
+			from_names[n] = name;
+		}
+		n++;
+	}
+	cg_moves(ctx, cg, n, to, to_names, from, from_names);
 }
 
-// r1 <- r1 << r2
-int cg_shl(int r1, int r2) {
-	out("\tmov cl, %s\n", reg8[r2]);
-	out("\tshl %s, cl\n", reg64[r1]);
-	cg_reg_free(r2);
-	return r1;
+static void cg_ret(struct tc_context* ctx, struct cg_func* cg, struct ir_instr* i) {
+	if (i->a >= 0)
+		cg_load(ctx, cg, RAX, i->a);
+	else
+		out(ctx, "\txor eax, eax\n");
+	for (int r = 0; r <= R15; r++) {
+		if (cg->saved & (1u << r))
+			out(ctx, "\tmov %s, [rbp%d]\n", reg64[r], cg->save_offset[r]);
+	}
+	out(ctx, "\tleave\n");
+	out(ctx, "\tret\n");
 }
 
-// r1 <- r1 >> r2
-int cg_shr(int r1, int r2) {
-	out("\tmov cl, %s\n", reg8[r2]);
-	out("\tshr %s, cl\n", reg64[r1]);
-	cg_reg_free(r2);
-	return r1;
+// writes the instruction at 'ii' in block 'b'. returns how many
+// instructions it took care of
+static int cg_instr(struct tc_context* ctx, struct cg_func* cg, struct ir_block* b, int ii) {
+	struct ir_instr* i = b->instrs->data[ii];
+	switch (i->op) {
+		case IR_IMM:
+			if (cg->loc[i->dst] == LOC_IMM)
+				break;
+			if (!cg_inreg(cg, i->dst) && (i->imm < -0x80000000L || i->imm > 0x7fffffffL)) {
+				out(ctx, "\tmov %s, %ld\n", reg64[SCRATCH1], i->imm);
+				cg_store(ctx, cg, i->dst, SCRATCH1);
+			} else {
+				out(ctx, "\tmov %s, %ld\n", cg->names[i->dst], i->imm);
+			}
+			break;
+		case IR_STRING: {
+			int t = cg_target(cg, i->dst, SCRATCH1);
+			out(ctx, "\tmov %s, LC%ld\n", reg64[t], i->imm);
+			cg_store(ctx, cg, i->dst, t);
+			} break;
+		case IR_CAST: {
+			int t = cg_target(cg, i->dst, SCRATCH1);
+			cg_load(ctx, cg, t, i->a);
+			cg_extend(ctx, t, i->type);
+			cg_store(ctx, cg, i->dst, t);
+			} break;
+		case IR_MOV: {
+			int t = cg_target(cg, i->dst, SCRATCH1);
+			cg_load(ctx, cg, t, i->a);
+			cg_store(ctx, cg, i->dst, t);
+			} break;
+		case IR_PARAM: {
+			int n = 0;
+			while (ii + n < b->instrs->size && ((struct ir_instr*) b->instrs->data[ii + n])->op == IR_PARAM)
+				n++;
+			cg_params(ctx, cg, (struct ir_instr**) b->instrs->data + ii, n);
+			return n;
+			}
+
+		case IR_LOAD_VAR: {
+			int t = cg_target(cg, i->dst, SCRATCH1);
+			if (i->sym->sym_type == SYM_GLOBAL)
+				cg_load_mem(ctx, t, i->type, i->sym->name, 0);
+			else
+				error(ctx, "cg_instr: invalid symbol type %d.\n", i->sym->sym_type);
+			cg_store(ctx, cg, i->dst, t);
+			} break;
+		case IR_STORE_VAR: {
+			int r = cg_reg(ctx, cg, i->a, SCRATCH1);
+			if (i->sym->sym_type == SYM_GLOBAL)
+				cg_store_mem(ctx, r, i->type, i->sym->name, 0);
+			else
+				error(ctx, "cg_instr: invalid symbol type %d.\n", i->sym->sym_type);
+			} break;
+		case IR_LOAD: {
+			int addr = cg_reg(ctx, cg, i->a, SCRATCH2);
+			int t = cg_target(cg, i->dst, SCRATCH1);
+			cg_load_mem(ctx, t, i->type, reg64[addr], 0);
+			cg_store(ctx, cg, i->dst, t);
+			} break;
+		case IR_STORE: {
+			int addr = cg_reg(ctx, cg, i->a, SCRATCH2);
+			int r = cg_reg(ctx, cg, i->b, SCRATCH1);
+			cg_store_mem(ctx, r, i->type, reg64[addr], 0);
+			} break;
+
+		case IR_ADD: case IR_SUB: case IR_MUL: case IR_AND: case IR_OR:
+			cg_binop(ctx, cg, i);
+			break;
+		case IR_SHL: case IR_SHR:
+			cg_shift(ctx, cg, i);
+			break;
+		case IR_DIV:
+			cg_div(ctx, cg, i);
+			break;
+		case IR_EQ: case IR_NE: case IR_LT: case IR_GT: case IR_LE: case IR_GE: {
+			cg_compare(ctx, cg, i);
+			// a comparison only feeding the branch after it becomes the
+			// branch's condition
+			struct ir_instr* next = ii + 1 < b->instrs->size ? b->instrs->data[ii + 1] : NULL;
+			if (next != NULL && next->op == IR_BR && next->a == i->dst && cg->uses[i->dst] == 1) {
+				cg_branch(ctx, b, next, cg_cond(i->op, false), cg_cond(i->op, true));
+				return 2;
+			}
+			int t = cg_target(cg, i->dst, SCRATCH1);
+			out(ctx, "\tset%s %s\n", cg_cond(i->op, false), reg8[t]);
+			out(ctx, "\tmovzx %s, %s\n", reg32[t], reg8[t]);
+			cg_store(ctx, cg, i->dst, t);
+			} break;
+
+		case IR_CALL:
+			cg_call(ctx, cg, i);
+			break;
+		case IR_JMP:
+			if (i->target->index != b->index + 1)
+				cg_label_ref(ctx, "jmp", i->target);
+			break;
+		case IR_BR:
+			if (cg_inreg(cg, i->a))
+				out(ctx, "\ttest %s, %s\n", cg->names[i->a], cg->names[i->a]);
+			else
+				out(ctx, "\tcmp %s, 0\n", cg->names[i->a]);
+			cg_branch(ctx, b, i, "nz", "z");
+			break;
+		case IR_RET:
+			cg_ret(ctx, cg, i);
+			break;
+	}
+	return 1;
 }
 
 /*
- * Binary equality
+ * Functions
  */
-// r1 <- r1 == r2
-int cg_eq(int r1, int r2) {
-	out("\tcmp %s, %s\n", reg64[r1], reg64[r2]);
-	out("\tsete %s\n", reg8[r1]);
-	out("\tand %s, 1\n", reg64[r1]);
-	cg_reg_free(r2);
-	return r1;
-}
-
-// r1 <- r1 != r2
-int cg_neq(int r1, int r2) {
-	out("\tcmp %s, %s\n", reg64[r1], reg64[r2]);
-	out("\tsetne %s\n", reg8[r1]);
-	out("\tand %s, 1\n", reg64[r1]);
-	cg_reg_free(r2);
-	return r1;
-}
-
-// r1 <- r1 < r2
-int cg_lt(int r1, int r2) {
-	out("\tcmp %s, %s\n", reg64[r1], reg64[r2]);
-	out("\tsetl %s\n", reg8[r1]);
-	out("\tand %s, 1\n", reg64[r1]);
-	cg_reg_free(r2);
-	return r1;
-}
-
-// r1 <- r1 > r2
-int cg_gt(int r1, int r2) {
-	out("\tcmp\t%s, %s\n", reg64[r1], reg64[r2]);
-	out("\tsetg\t%s\n", reg8[r1]);
-	out("\tand %s, 1\n", reg64[r1]);
-	cg_reg_free(r2);
-	return r1;
-}
-
-// r1 <- r1 <= r2
-int cg_lte(int r1, int r2) {
-	out("\tcmp\t%s, %s\n", reg64[r1], reg64[r2]);
-	out("\tsetle\t%s\n", reg8[r1]);
-	out("\tand %s, 1\n", reg64[r1]);
-	cg_reg_free(r2);
-	return r1;
-}
-
-// r1 <- r1 >= r2
-int cg_gte(int r1, int r2) {
-	out("\tcmp\t%s, %s\n", reg64[r1], reg64[r2]);
-	out("\tsetge\t%s\n", reg8[r1]);
-	out("\tand %s, 1\n", reg64[r1]);
-	cg_reg_free(r2);
-	return r1;
+static void cg_func_pre(struct tc_context* ctx, struct cg_func* cg, struct func* f) {
+	// Standard function header
+	out(ctx, "global %s\n", f->name);
+	out(ctx, "%s:\n", f->name);
+	out(ctx, "\tpush rbp\n");
+	out(ctx, "\tmov rbp, rsp\n");
+
+	for (int i = 0; i < f->st->syms->size; i++) {
+		struct sym* s = f->st->syms->data[i];
+		if (type_getsize(s->type) == 0)
+			error(ctx, "bad parameter type %s.\n", type_tostr(s->type));
+	}
+
+	// Make space in the stack for whatever didn't fit in registers, and
+	// keep the callee-saved registers used
+	if (cg->frame_size > 0)
+		out(ctx, "\tsub rsp, %d\n", cg->frame_size);
+	for (int r = 0; r <= R15; r++) {
+		if (cg->saved & (1u << r))
+			out(ctx, "\tmov [rbp%d], %s\n", cg->save_offset[r], reg64[r]);
+	}
 }
 
-/*
- * Pre and postambles
- */
-static int get_last_offset(struct stmt* s) {
-	if (s->stmt_type != STMT_COMPOUND)
-		return 0;
-	int offset = -sym_get_last_offset(s->compound.st);
-	for (int i = 0; i < s->compound.stmts->size; i++) {
-		int new_offset = get_last_offset(s->compound.stmts->data[i]);
-		if (new_offset > offset)
-			offset = new_offset;
+// writes the code for the function in 'ir'
+void cg_func(struct tc_context* ctx, struct ir_func* ir) {
+	struct arena* a = ir->arena;
+	struct cg_func* cg = arena_push(a, sizeof(struct cg_func));
+	memset(cg, 0, sizeof(struct cg_func));
+	cg->ir = ir;
+	int n = ir->reg_count;
+	int count = ir->instr_count;
+	cg->start = arena_push(a, n * sizeof(int));
+	cg->end = arena_push(a, n * sizeof(int));
+	cg->uses = arena_push(a, n * sizeof(int));
+	cg->writes = arena_push(a, n * sizeof(int));
+	cg->defs = arena_push(a, n * sizeof(struct ir_instr*));
+	cg->hint = arena_push(a, n * sizeof(int));
+	cg->loc = arena_push(a, n * sizeof(int));
+	cg->names = arena_push(a, n * sizeof(char*));
+	cg->calls = arena_push(a, count * sizeof(int));
+	cg->divs = arena_push(a, count * sizeof(int));
+	cg->shifts = arena_push(a, count * sizeof(int));
+	cg->block_first = arena_push(a, ir->blocks->size * sizeof(int));
+	cg->targeted = arena_push(a, ir->blocks->size * sizeof(bool));
+	memset(cg->start, 0, n * sizeof(int));
+	memset(cg->end, 0, n * sizeof(int));
+	memset(cg->uses, 0, n * sizeof(int));
+	memset(cg->writes, 0, n * sizeof(int));
+	memset(cg->defs, 0, n * sizeof(struct ir_instr*));
+	memset(cg->hint, -1, n * sizeof(int));
+	memset(cg->loc, -1, n * sizeof(int));
+	memset(cg->names, 0, n * sizeof(char*));
+	memset(cg->targeted, 0, ir->blocks->size * sizeof(bool));
+
+	cg_scan(cg);
+	cg_liveness(cg);
+	cg_fold_imms(cg);
+	cg_allocate(cg);
+
+	cg_func_pre(ctx, cg, ir->func);
+	for (int bi = 0; bi < ir->blocks->size; bi++) {
+		struct ir_block* b = ir->blocks->data[bi];
+		if (cg->targeted[bi])
+			out(ctx, ".L%d:\n", bi);
+		for (int ii = 0; ii < b->instrs->size;)
+			ii += cg_instr(ctx, cg, b, ii);
 	}
-	return offset;
 }
 
-void cg_func_pre(struct func* f) {
-	// Standard function header
-	out("global %s\n", f->name);
-	out("%s:\n", f->name);
-	out("\tpush rbp\n");
-	out("\tmov rbp, rsp\n");
-
-	// Make space in the stack for local variables and arguments
-	int last_offset = get_last_offset(f->stmt);
-	if (last_offset > 0)
-		out("\tsub rsp, %d\n", last_offset);
-
-	// Move arguments from registers to the stack
-	for (int i = 0; i < f->st->syms->size && i < 6; i++) {
-		struct sym* s = f->st->syms->data[i];
-		switch (type_getsize(s->type)) {
-			case 1:
-				out("\tmov eax, %s\n", arg_reg32[i]);
-				out("\tmov [rbp%d], al\n", s->offset);
-				break;
-			case 2:
-				out("\tmov eax, %s\n", arg_reg32[i]);
-				out("\tmov [rbp%d], ax\n", s->offset);
-				break;
-			case 4:
-				out("\tmov [rbp%d], %s\n", s->offset, arg_reg32[i]);
-				break;
-			case 8:
-				out("\tmov [rbp%d], %s\n", s->offset, arg_reg64[i]);
-				break;
-			default:
-				printf("Code generation error: bad parameter type %s\n", type_tostr(s->type));
-				exit(1);
-		}
+/*
+ * Library
+ */
+static void cg_decl_global(struct tc_context* ctx, struct sym* s) {
+	out(ctx, "%s ", s->name);
+	switch (type_getsize(s->type)) {
+		case 1: out(ctx, "db 0\n"); break;
+		case 2: out(ctx, "dw 0\n"); break;
+		case 4: out(ctx, "dd 0\n"); break;
+		case 8: out(ctx, "dq 0\n"); break;
+		default:
+			error(ctx, "cg_decl_global\n");
+			break;
 	}
 }
 
-void cg_func_post(struct func* f) {
-	if (f->type == TYPE_0)
-		cg_ret(-1);
+static void cg_decl_string(struct tc_context* ctx, struct sym* s) {
+	out(ctx, "LC%d: db ", s->offset);
+	for (char* str = s->name; *str; str++)
+		out(ctx, "%d, ", *str);
+	out(ctx, "0\n");
 }
 
-void cg_lib_post(struct lib* l) {
+void cg_lib_post(struct tc_context* ctx, struct lib* l) {
 	for (int i = 0; i < l->st->syms->size; i++) {
 		struct sym* s = l->st->syms->data[i];
 		if (s->sym_type == SYM_GLOBAL)
-			cg_decl_global(s);
+			cg_decl_global(ctx, s);
 		else if (s->sym_type == SYM_STRING)
-			cg_decl_string(s);
+			cg_decl_string(ctx, s);
 	}
 }
@@ -1,153 +1,444 @@
 #include "gen.h"
 
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "cg.h"
+#include "context.h"
+#include "ir.h"
 #include "lexer.h"
 #include "parser.h"
+#include "pool.h"
 #include "sym.h"
 
-static int error(const char* format, ...) {
+static _Noreturn int error(struct tc_context* ctx, const char* format, ...) {
 	va_list args;
 	va_start(args, format);
-	printf("Code generation error: ");
-	vprintf(format, args);
-	va_end(args);
-	exit(1);
-	return -1;
-}
-
-static int gen_lvalue(struct expr* e, struct symtable* st) {
-	while (e->expr_type == EXPR_DEREF)
-		e = e->unop;
-	int r = gen_expr(e, st);
-	while (e->parent->expr_type == EXPR_DEREF) {
-		if (e->parent->parent->expr_type == EXPR_DEREF)
-			r = cg_load_addr(r, e->type);
-		e = e->parent;
+	tc_verror(ctx, -1, format, args);
+}
+
+// Binary operators, by expression type
+static const enum ir_op gen_binops[] = {
+	[EXPR_ADD] = IR_ADD, [EXPR_SUB] = IR_SUB, [EXPR_MUL] = IR_MUL, [EXPR_DIV] = IR_DIV,
+	[EXPR_AND] = IR_AND, [EXPR_OR] = IR_OR, [EXPR_SHL] = IR_SHL, [EXPR_SHR] = IR_SHR,
+	[EXPR_EQ] = IR_EQ, [EXPR_NEQ] = IR_NE, [EXPR_LT] = IR_LT, [EXPR_GT] = IR_GT,
+	[EXPR_LTE] = IR_LE, [EXPR_GTE] = IR_GE,
+};
+
+// appends an instruction computing a new virtual register
+static struct ir_instr* gen_value(struct ir_func* ir, enum ir_op op, int a, int b) {
+	return ir_emit(ir, op, ir_reg(ir), a, b);
+}
+
+// Labels 'e' and everything in it with the registers it needs, taking the
+// operand that needs more first: evaluating two operands that need as
+// many takes one more register to hold the first, but the lighter one
+// fits in what is left over from the heavier one
+static void gen_label(struct expr* e) {
+	switch (e->expr_type) {
+		case EXPR_NUMBER: case EXPR_STRING: case EXPR_NAME:
+			e->regs = 1;
+			e->effects = false;
+			break;
+		case EXPR_CALL: {
+			// arguments are evaluated last to first, each held while the
+			// ones after it are evaluated
+			int n = e->call.func->param_count;
+			e->regs = 1;
+			for (int k = n - 1; k >= 0; k--) {
+				gen_label(e->call.args[k]);
+				if (e->call.args[k]->regs + n - 1 - k > e->regs)
+					e->regs = e->call.args[k]->regs + n - 1 - k;
+			}
+			e->effects = true;
+			} break;
+		case EXPR_CAST: case EXPR_DEREF:
+			gen_label(e->unop);
+			e->regs = e->unop->regs;
+			e->effects = e->unop->effects;
+			break;
+		default: {
+			struct expr* l = e->binop.left;
+			struct expr* r = e->binop.right;
+			gen_label(l);
+			gen_label(r);
+			e->regs = l->regs == r->regs ? l->regs + 1 : l->regs > r->regs ? l->regs : r->regs;
+			e->effects = l->effects || r->effects || e->expr_type == EXPR_ASSIGN;
+			} break;
 	}
-	return r;
 }
 
-int gen_expr(struct expr* e, struct symtable* st) {
+// labels and evaluates a whole expression
+static int gen_root(struct tc_context* ctx, struct expr* e) {
+	gen_label(e);
+	return gen_expr(ctx, e);
+}
+
+static bool gen_islocal(struct expr* e) {
+	return e->expr_type == EXPR_NAME && e->sym->sym_type == SYM_LOCAL;
+}
+
+// whether the value of 'e' may be left in the register of a local, rather
+// than in one of its own
+static bool gen_isvar(struct expr* e) {
+	return gen_islocal(e) || e->expr_type == EXPR_ASSIGN;
+}
+
+// whether evaluating 'e' assigns to a local
+static bool gen_assigns(struct expr* e) {
+	switch (e->expr_type) {
+		case EXPR_NUMBER: case EXPR_STRING: case EXPR_NAME:
+			return false;
+		case EXPR_CALL:
+			for (int k = 0; k < e->call.func->param_count; k++) {
+				if (gen_assigns(e->call.args[k]))
+					return true;
+			}
+			return false;
+		case EXPR_CAST: case EXPR_DEREF:
+			return gen_assigns(e->unop);
+		case EXPR_ASSIGN:
+			if (gen_islocal(e->binop.left))
+				return true;
+			// fallthrough
+		default:
+			return gen_assigns(e->binop.left) || gen_assigns(e->binop.right);
+	}
+}
+
+// 'v', the value of 'e', as it is before 'later' is evaluated. a local's
+// register is copied if 'later' might assign to it
+static int gen_keep(struct ir_func* ir, struct expr* e, int v, struct expr* later) {
+	if (gen_isvar(e) && gen_assigns(later))
+		return gen_value(ir, IR_MOV, v, -1)->dst;
+	return v;
+}
+
+// local 's' <- 'v', the value of 'e'. values are kept extended to the
+// type of the local, as they would be if it were loaded from memory
+static void gen_assign_var(struct ir_func* ir, struct sym* s, struct expr* e, int v) {
+	int var = ir_var(ir, s);
+	if (type_getsize(s->type) < 8) {
+		ir_emit(ir, IR_CAST, var, v, -1)->type = s->type;
+		return;
+	}
+	// a value just computed is computed straight into the local
+	struct vec* instrs = ir->block->instrs;
+	struct ir_instr* last = instrs->data[instrs->size - 1];
+	if (!gen_isvar(e) && last->dst == v)
+		last->dst = var;
+	else
+		ir_emit(ir, IR_MOV, var, v, -1);
+}
+
+// returns the virtual register holding the value of 'e', once labelled by
+// gen_label()
+int gen_expr(struct tc_context* ctx, struct expr* e) {
+	struct ir_func* ir = ctx->ir;
 	enum expr_type et = e->expr_type;
+	struct ir_instr* i;
 	switch (et) {
-		// Register loading
-		case EXPR_NUMBER: return cg_load_number(e->number);
-		case EXPR_STRING: return cg_load_string(e->number);
-		case EXPR_NAME: return cg_load_name(e->name, st);
-		case EXPR_CALL:
-			cg_reg_push_used();
-			for (int i = e->call.args->size - 1; i >= 0; i--) {
-				int r = gen_expr(e->call.args->data[i], st);
-				cg_push_arg(i, r);
-				cg_reg_free(r);
+		case EXPR_NUMBER:
+			i = gen_value(ir, IR_IMM, -1, -1);
+			i->imm = e->number;
+			return i->dst;
+		case EXPR_STRING:
+			i = gen_value(ir, IR_STRING, -1, -1);
+			i->imm = e->sym->offset;
+			return i->dst;
+		case EXPR_NAME:
+			if (e->sym->sym_type == SYM_LOCAL)
+				return ir_var(ir, e->sym);
+			i = gen_value(ir, IR_LOAD_VAR, -1, -1);
+			i->sym = e->sym;
+			i->type = e->sym->type;
+			return i->dst;
+		case EXPR_CALL: {
+			// arguments are evaluated last to first
+			struct sym* f = e->call.func;
+			int* args = arena_push(ir->arena, f->param_count * sizeof(int));
+			for (int k = f->param_count - 1; k >= 0; k--) {
+				args[k] = gen_expr(ctx, e->call.args[k]);
+				// see gen_keep(), against each argument still to come
+				for (int j = 0; j < k && gen_isvar(e->call.args[k]); j++) {
+					if (gen_assigns(e->call.args[j])) {
+						args[k] = gen_value(ir, IR_MOV, args[k], -1)->dst;
+						break;
+					}
+				}
+			}
+			i = gen_value(ir, IR_CALL, -1, -1);
+			i->sym = f;
+			i->args = args;
+			i->arg_count = f->param_count;
+			return i->dst;
 			}
-			return cg_call(e->call.call->name);
 
 		// Unary prefix
-		case EXPR_CAST: return cg_cast(gen_expr(e->unop, st), e->type);
-//		case EXPR_ADDROF: return cg_addrof(e->name, st);
-		case EXPR_DEREF: return cg_load_addr(gen_expr(e->unop, st), e->type);
+		case EXPR_CAST:
+			i = gen_value(ir, IR_CAST, gen_expr(ctx, e->unop), -1);
+			i->type = e->type;
+			return i->dst;
+		case EXPR_DEREF:
+			i = gen_value(ir, IR_LOAD, gen_expr(ctx, e->unop), -1);
+			i->type = e->type;
+			return i->dst;
 
 		// Binary
-		case EXPR_ADD: return cg_add(gen_expr(e->binop.left, st), gen_expr(e->binop.right, st));
-		case EXPR_SUB: return cg_sub(gen_expr(e->binop.left, st), gen_expr(e->binop.right, st));
-		case EXPR_MUL: return cg_mul(gen_expr(e->binop.left, st), gen_expr(e->binop.right, st));
-		case EXPR_DIV: return cg_div(gen_expr(e->binop.left, st), gen_expr(e->binop.right, st));
-		case EXPR_AND: return cg_and(gen_expr(e->binop.left, st), gen_expr(e->binop.right, st));
-		case EXPR_OR: return cg_or(gen_expr(e->binop.left, st), gen_expr(e->binop.right, st));
-		case EXPR_SHL: return cg_shl(gen_expr(e->binop.left, st), gen_expr(e->binop.right, st));
-		case EXPR_SHR: return cg_shr(gen_expr(e->binop.left, st), gen_expr(e->binop.right, st));
-
-		// Binary equality
-		case EXPR_EQ: return cg_eq(gen_expr(e->binop.left, st), gen_expr(e->binop.right, st));
-		case EXPR_NEQ: return cg_neq(gen_expr(e->binop.left, st), gen_expr(e->binop.right, st));
-		case EXPR_LT: return cg_lt(gen_expr(e->binop.left, st), gen_expr(e->binop.right, st));
-		case EXPR_GT: return cg_gt(gen_expr(e->binop.left, st), gen_expr(e->binop.right, st));
-		case EXPR_LTE: return cg_lte(gen_expr(e->binop.left, st), gen_expr(e->binop.right, st));
-		case EXPR_GTE: return cg_gte(gen_expr(e->binop.left, st), gen_expr(e->binop.right, st));
-
-		// Binary assignment
-		case EXPR_ASSIGN:
-			if (e->binop.left->expr_type == EXPR_NAME) {
-				cg_store_name(
-					gen_expr(e->binop.right, st),
-					e->binop.left->name,
-					st);
-				return -1;
-			} else if (e->binop.left->expr_type == EXPR_DEREF) {
-				cg_store_addr(
-					gen_expr(e->binop.right, st),
-					gen_lvalue(e->binop.left->unop, st),
-					type_gettype(e->binop.left->type));
-				return -1;
+		case EXPR_ADD: case EXPR_SUB: case EXPR_MUL: case EXPR_DIV:
+		case EXPR_AND: case EXPR_OR: case EXPR_SHL: case EXPR_SHR:
+		case EXPR_EQ: case EXPR_NEQ: case EXPR_LT: case EXPR_GT: case EXPR_LTE: case EXPR_GTE: {
+			struct expr* l = e->binop.left;
+			struct expr* r = e->binop.right;
+			int a, b;
+			// when neither operand can change what the other sees, the
+			// heavier one goes first
+			if (!l->effects && !r->effects && r->regs > l->regs) {
+				b = gen_expr(ctx, r);
+				a = gen_expr(ctx, l);
+			} else {
+				a = gen_keep(ir, l, gen_expr(ctx, l), r);
+				b = gen_expr(ctx, r);
+			}
+			return gen_value(ir, gen_binops[et], a, b)->dst;
+			}
+
+		// Binary assignment, giving the value assigned
+		case EXPR_ASSIGN: {
+			struct expr* left = e->binop.left;
+			if (gen_islocal(left)) {
+				int v = gen_expr(ctx, e->binop.right);
+				gen_assign_var(ir, left->sym, e->binop.right, v);
+				// the register of the local, unless it's narrower
+				return type_getsize(left->sym->type) < 8 ? v : ir_var(ir, left->sym);
+			} else if (left->expr_type == EXPR_NAME) {
+				int v = gen_expr(ctx, e->binop.right);
+				i = ir_emit(ir, IR_STORE_VAR, -1, v, -1);
+				i->sym = left->sym;
+				i->type = left->sym->type;
+				return v;
+			} else if (left->expr_type == EXPR_DEREF) {
+				int v = gen_keep(ir, e->binop.right, gen_expr(ctx, e->binop.right), left->unop);
+				int addr = gen_expr(ctx, left->unop);
+				ir_emit(ir, IR_STORE, -1, addr, v)->type = left->type;
+				return v;
+			}
+			return error(ctx, "can't assign to expr type %d\n", et);
 			}
-			return error("can't assign to expr type %d\n", et);
 		default:
-			return error("unknown expression type '%d'.\n", et);
+			return error(ctx, "unknown expression type '%d'.\n", et);
 	}
 }
 
-void gen_stmt(struct stmt* s, struct symtable* st) {
+void gen_stmt(struct tc_context* ctx, struct stmt* s) {
+	struct ir_func* ir = ctx->ir;
 	switch (s->stmt_type) {
 		case STMT_COMPOUND:
 			for (int i = 0; i < s->compound.stmts->size; i++) {
-				gen_stmt(s->compound.stmts->data[i], s->compound.st);
+				gen_stmt(ctx, s->compound.stmts->data[i]);
 			}
 			break;
-		case STMT_IF:
+		case STMT_IF: {
+			struct ir_block* btrue = ir_block_alloc(ir);
+			struct ir_block* bend = ir_block_alloc(ir);
+			struct ir_block* bfalse = s->_if._false ? ir_block_alloc(ir) : bend;
+			ir_branch(ir, gen_root(ctx, s->_if.cond), btrue, bfalse);
+			ir_start(ir, btrue);
+			gen_stmt(ctx, s->_if._true);
 			if (s->_if._false) {
-				int lelse = cg_new_label();
-				int lend = cg_new_label();
-				cg_jmp_if_false(lelse, gen_expr(s->_if.cond, st));
-				gen_stmt(s->_if._true, st);
-				cg_jmp(lend);
-				cg_decl_label(lelse);
-				gen_stmt(s->_if._false, st);
-				cg_decl_label(lend);
-			} else {
-				int lend = cg_new_label();
-				cg_jmp_if_false(lend, gen_expr(s->_if.cond, st));
-				gen_stmt(s->_if._true, st);
-				cg_decl_label(lend);
+				ir_jump(ir, bend);
+				ir_start(ir, bfalse);
+				gen_stmt(ctx, s->_if._false);
 			}
-			break;
-		case STMT_WHILE:
-			{
-				int lstart = cg_new_label();
-				int lend = cg_new_label();
-				cg_decl_label(lstart);
-				cg_jmp_if_false(lend, gen_expr(s->_while.cond, st));
-				gen_stmt(s->_while.stmt, st);
-				cg_jmp(lstart);
-				cg_decl_label(lend);
-			}
-			break;
+			ir_start(ir, bend);
+			} break;
+		case STMT_WHILE: {
+			struct ir_block* bcond = ir_block_alloc(ir);
+			struct ir_block* bbody = ir_block_alloc(ir);
+			struct ir_block* bend = ir_block_alloc(ir);
+			ir_start(ir, bcond);
+			ir_branch(ir, gen_root(ctx, s->_while.cond), bbody, bend);
+			ir_start(ir, bbody);
+			gen_stmt(ctx, s->_while.stmt);
+			ir_jump(ir, bcond);
+			ir_start(ir, bend);
+			} break;
 		case STMT_RETURN:
-			cg_ret(s->expr ? gen_expr(s->expr, st) : -1);
+			ir_emit(ir, IR_RET, -1, s->expr ? gen_root(ctx, s->expr) : -1, -1);
 			break;
 		case STMT_EXPR:
-			gen_expr(s->expr, st);
+			gen_root(ctx, s->expr);
 			break;
 		case STMT_NOOP:
 			break;
 		default:
-			error("unknown statement type '%d'.\n", s->stmt_type);
+			error(ctx, "unknown statement type '%d'.\n", s->stmt_type);
 			break;
 	}
-	cg_reg_free_all();
 }
 
-void gen_func(struct func* f) {
-	cg_func_pre(f);
-	gen_stmt(f->stmt, f->st);
-	cg_func_post(f);
+// takes the parameters into the registers of their locals, all at once
+// since they arrive in registers that are needed for other things
+static void gen_params(struct ir_func* ir, struct func* f) {
+	struct vec* params = f->st->syms;
+	int* regs = arena_push(ir->arena, params->size * sizeof(int));
+	for (int k = 0; k < params->size; k++) {
+		struct sym* s = params->data[k];
+		regs[k] = type_getsize(s->type) < 8 ? ir_reg(ir) : ir_var(ir, s);
+		ir_emit(ir, IR_PARAM, regs[k], -1, -1)->imm = k;
+	}
+	for (int k = 0; k < params->size; k++) {
+		struct sym* s = params->data[k];
+		if (regs[k] != ir_var(ir, s))
+			ir_emit(ir, IR_CAST, ir_var(ir, s), regs[k], -1)->type = s->type;
+	}
+}
+
+// builds the IR for 'f' and hands it to the code generator. everything in
+// between lives in the gen arena, which is cleared for the next function
+void gen_func(struct tc_context* ctx, struct func* f) {
+	int phase = trace_switch(ctx, PHASE_GEN);
+	struct trace_time start;
+	trace_begin(ctx, &start);
+	ctx->ir = ir_func_alloc(ctx->gen_arena, f);
+	gen_params(ctx->ir, f);
+	gen_stmt(ctx, f->stmt);
+	// falling off the end returns 0
+	if (ctx->ir->block != NULL)
+		ir_emit(ctx->ir, IR_RET, -1, -1, -1);
+	ir_prune(ctx->ir);
+	cg_func(ctx, ctx->ir);
+	ctx->ir = NULL;
+	arena_reset(ctx->gen_arena);
+	trace_end(ctx, &start, "gen", f->name);
+	trace_switch(ctx, phase);
 }
 
-void gen(struct lib* l) {
-	for (int i = l->funcs->size - 1; i >= 0; i--)
-		gen_func(l->funcs->data[i]);
-	cg_lib_post(l);
+// emits the functions still held in 'l', then its globals and strings
+void gen(struct tc_context* ctx, struct lib* l) {
+	for (int i = 0; i < l->funcs->size; i++)
+		gen_func(ctx, l->funcs->data[i]);
+	cg_lib_post(ctx, l);
+}
+
+/*
+ * Parallel
+ */
+// A piece of the output, kept in memory until everything before it is
+// ready: either the code for 'func', or whatever was written between two
+// functions, like asm blocks or the globals and strings at the end
+struct gen_chunk {
+	struct func* func;
+	char* data;
+	size_t size;
+};
+
+static void gen_chunk_open(struct tc_context* ctx, struct func* f) {
+	struct gen_chunk* c = arena_push(ctx->parse_arena, sizeof(struct gen_chunk));
+	c->func = f;
+	c->data = NULL;
+	c->size = 0;
+	vec_push(ctx->gen_chunks, c);
+	if (f == NULL)
+		ctx->output_file = open_memstream(&c->data, &c->size);
+}
+
+// starts holding back the output, so functions can be queued with
+// gen_queue() as they are parsed and generated all at once by gen_flush()
+void gen_begin(struct tc_context* ctx) {
+	ctx->gen_file = ctx->output_file;
+	ctx->gen_chunks = vec_alloc(ctx->parse_arena);
+	gen_chunk_open(ctx, NULL);
+}
+
+// leaves a place in the output for the code of 'f'
+void gen_queue(struct tc_context* ctx, struct func* f) {
+	fclose(ctx->output_file);
+	gen_chunk_open(ctx, f);
+	gen_chunk_open(ctx, NULL);
+}
+
+struct gen_pool {
+	struct tc_context* ctx;
+	atomic_int next;
+	// the first chunk that failed and its message
+	pthread_mutex_t lock;
+	int failed;
+	char* error;
+};
+
+// generates queued functions until there are none left, in a context of
+// its own that only shares the input and the trees with the others
+static void* gen_worker(void* p) {
+	struct gen_pool* pool = p;
+	struct vec* chunks = pool->ctx->gen_chunks;
+	struct tc_context* ctx = malloc(sizeof(struct tc_context));
+	memcpy(ctx, pool->ctx, sizeof(struct tc_context));
+	ctx->gen_arena = arena_alloc();
+
+	for (int i; (i = atomic_fetch_add(&pool->next, 1)) < chunks->size;) {
+		struct gen_chunk* c = chunks->data[i];
+		if (c->func == NULL)
+			continue;
+		ctx->output_file = open_memstream(&c->data, &c->size);
+		if (setjmp(ctx->on_error)) {
+			fclose(ctx->output_file);
+			pthread_mutex_lock(&pool->lock);
+			if (pool->failed < 0 || i < pool->failed) {
+				pool->failed = i;
+				free(pool->error);
+				pool->error = strdup(ctx->error);
+			}
+			pthread_mutex_unlock(&pool->lock);
+			break;
+		}
+		gen_func(ctx, c->func);
+		fclose(ctx->output_file);
+	}
+	arena_free(ctx->gen_arena);
+	free(ctx);
+	return NULL;
+}
+
+// generates the queued functions on 'threads' threads and writes out all
+// the chunks in order, so the output is the same as generating one
+// function at a time
+void gen_flush(struct tc_context* ctx, int threads) {
+	fclose(ctx->output_file);
+	ctx->output_file = ctx->gen_file;
+
+	struct gen_pool pool = { .ctx = ctx, .next = 0, .failed = -1, .error = NULL };
+	pthread_mutex_init(&pool.lock, NULL);
+	trace_cpu(ctx, pool_run(threads, gen_worker, &pool));
+	pthread_mutex_destroy(&pool.lock);
+
+	if (pool.failed >= 0) {
+		snprintf(ctx->error, sizeof(ctx->error), "%s", pool.error);
+		free(pool.error);
+		longjmp(ctx->on_error, 1);
+	}
+	for (int i = 0; i < ctx->gen_chunks->size; i++) {
+		struct gen_chunk* c = ctx->gen_chunks->data[i];
+		fwrite(c->data, 1, c->size, ctx->output_file);
+	}
+	gen_release(ctx);
+}
+
+// frees whatever output is still held back, after an error or a flush
+void gen_release(struct tc_context* ctx) {
+	if (ctx->gen_chunks == NULL)
+		return;
+	if (ctx->output_file != ctx->gen_file) {
+		fclose(ctx->output_file);
+		ctx->output_file = ctx->gen_file;
+	}
+	for (int i = 0; i < ctx->gen_chunks->size; i++) {
+		struct gen_chunk* c = ctx->gen_chunks->data[i];
+		free(c->data);
+	}
+	ctx->gen_chunks = NULL;
+	ctx->gen_file = NULL;
 }
@@ -0,0 +1,63 @@
+#include "intern.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "context.h"
+
+static unsigned int hash(const char* s, int length) {
+	unsigned int h = 2166136261u;
+	for (int i = 0; i < length; i++)
+		h = (h ^ (unsigned char) s[i]) * 16777619u;
+	return h;
+}
+
+// identifiers are carved out of their own arena so they never move
+static struct ident* ident_alloc(struct tc_context* ctx, const char* s, int length, unsigned int h) {
+	struct ident* i = arena_push(ctx->ident_arena, sizeof(struct ident) + length + 1);
+	i->id = ctx->ident_count++;
+	i->length = length;
+	i->hash = h;
+	memcpy(i->name, s, length);
+	i->name[length] = '\0';
+	return i;
+}
+
+static void table_grow(struct tc_context* ctx) {
+	int old_capacity = ctx->ident_capacity;
+	struct ident** old = ctx->ident_table;
+	int capacity = old_capacity ? old_capacity * 2 : 1024;
+	struct ident** table = calloc(capacity, sizeof(struct ident*));
+	for (int i = 0; i < old_capacity; i++) {
+		if (old[i] == NULL)
+			continue;
+		int j = old[i]->hash & (capacity - 1);
+		while (table[j] != NULL)
+			j = (j + 1) & (capacity - 1);
+		table[j] = old[i];
+	}
+	free(old);
+	ctx->ident_table = table;
+	ctx->ident_capacity = capacity;
+}
+
+// returns the unique identifier for the 'length' characters at 's',
+// creating it the first time it is seen.
+struct ident* intern_get(struct tc_context* ctx, const char* s, int length) {
+	if (2 * (ctx->ident_count + 1) > ctx->ident_capacity)
+		table_grow(ctx);
+	struct ident** table = ctx->ident_table;
+	int mask = ctx->ident_capacity - 1;
+	unsigned int h = hash(s, length);
+	int j = h & mask;
+	for (struct ident* i; (i = table[j]) != NULL; j = (j + 1) & mask) {
+		if (i->hash == h && i->length == length && !memcmp(i->name, s, length))
+			return i;
+	}
+	return table[j] = ident_alloc(ctx, s, length, h);
+}
+
+int intern_count(struct tc_context* ctx) {
+	return ctx->ident_count;
+}
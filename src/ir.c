@@ -0,0 +1,113 @@
+#include "ir.h"
+
+#include <string.h>
+
+struct ir_func* ir_func_alloc(struct arena* a, struct func* f) {
+	struct ir_func* ir = arena_push(a, sizeof(struct ir_func));
+	ir->func = f;
+	ir->arena = a;
+	ir->blocks = vec_alloc(a);
+	ir->block = NULL;
+	ir->reg_count = 0;
+	ir->instr_count = 0;
+	ir->vars = arena_push(a, (f->st->frame_size + 1) * sizeof(int));
+	memset(ir->vars, -1, (f->st->frame_size + 1) * sizeof(int));
+	ir_start(ir, ir_block_alloc(ir));
+	return ir;
+}
+
+// allocates a block that isn't part of the layout until ir_start()
+struct ir_block* ir_block_alloc(struct ir_func* ir) {
+	struct ir_block* b = arena_push(ir->arena, sizeof(struct ir_block));
+	b->index = -1;
+	b->instrs = vec_alloc(ir->arena);
+	return b;
+}
+
+// places 'b' after the blocks so far and carries on adding to it. a block
+// left unfinished falls through to it
+void ir_start(struct ir_func* ir, struct ir_block* b) {
+	ir_jump(ir, b);
+	b->index = ir->blocks->size;
+	vec_push(ir->blocks, b);
+	ir->block = b;
+}
+
+int ir_reg(struct ir_func* ir) {
+	return ir->reg_count++;
+}
+
+// returns the register of local 's'. locals of scopes that are never open
+// at once can share a slot, and so share a register too
+int ir_var(struct ir_func* ir, struct sym* s) {
+	int* v = &ir->vars[-s->offset];
+	if (*v < 0)
+		*v = ir_reg(ir);
+	return *v;
+}
+
+// appends an instruction to the current block. code following a
+// terminator can't be reached, but still goes in a block of its own
+struct ir_instr* ir_emit(struct ir_func* ir, enum ir_op op, int dst, int a, int b) {
+	if (ir->block == NULL)
+		ir_start(ir, ir_block_alloc(ir));
+	struct ir_instr* i = arena_push(ir->arena, sizeof(struct ir_instr));
+	memset(i, 0, sizeof(struct ir_instr));
+	i->op = op;
+	i->dst = dst;
+	i->a = a;
+	i->b = b;
+	vec_push(ir->block->instrs, i);
+	ir->instr_count++;
+	if (ir_isterm(op))
+		ir->block = NULL;
+	return i;
+}
+
+// ends the current block with a jump to 'target', unless it already ended
+void ir_jump(struct ir_func* ir, struct ir_block* target) {
+	if (ir->block == NULL)
+		return;
+	ir_emit(ir, IR_JMP, -1, -1, -1)->target = target;
+}
+
+void ir_branch(struct ir_func* ir, int r, struct ir_block* target, struct ir_block* other) {
+	struct ir_instr* i = ir_emit(ir, IR_BR, -1, r, -1);
+	i->target = target;
+	i->other = other;
+}
+
+// drops the blocks nothing branches to, like the end of an if whose
+// branches both return, and numbers the rest in order again
+void ir_prune(struct ir_func* ir) {
+	int n = ir->blocks->size;
+	bool* reached = arena_push(ir->arena, n * sizeof(bool));
+	struct ir_block** stack = arena_push(ir->arena, n * sizeof(struct ir_block*));
+	memset(reached, 0, n * sizeof(bool));
+	int top = 0;
+	reached[0] = true;
+	stack[top++] = ir->blocks->data[0];
+	while (top > 0) {
+		struct ir_block* b = stack[--top];
+		struct ir_instr* last = b->instrs->data[b->instrs->size - 1];
+		struct ir_block* succs[2] = { last->target, last->other };
+		for (int k = 0; k < 2; k++) {
+			if (succs[k] != NULL && !reached[succs[k]->index]) {
+				reached[succs[k]->index] = true;
+				stack[top++] = succs[k];
+			}
+		}
+	}
+
+	int kept = 0;
+	for (int i = 0; i < n; i++) {
+		struct ir_block* b = ir->blocks->data[i];
+		if (reached[i]) {
+			b->index = kept;
+			ir->blocks->data[kept++] = b;
+		} else {
+			ir->instr_count -= b->instrs->size;
+		}
+	}
+	ir->blocks->size = kept;
+}
@@ -1,79 +1,84 @@
 #include "lexer.h"
 
 #include <ctype.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <setjmp.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "context.h"
+#include "intern.h"
+#include "pool.h"
+#include "scan.h"
 #include "token.h"
 
-extern char* input_filename;
-extern FILE* input_file;
-extern FILE* output_file;
-
-static int line = 1;
-static int line_index = 0;
-
-static void error(const char* format, ...) {
+static _Noreturn void error(struct tc_context* ctx, const char* format, ...) {
 	va_list args;
 	va_start(args, format);
-	printf("%s:%d:%d: error: ", input_filename, line, line_index);
-	vprintf(format, args);
-	va_end(args);
-	exit(1);
+	tc_verror(ctx, ctx->cur - ctx->start - 1, format, args);
 }
 
 /*
  * Reading
  */
-static int next() {
-	int c = fgetc(input_file);
-	line_index++;
-	if (c == '\n') {
-		line++;
-		line_index = 0;
-	}
-	return c;
+static int next(struct tc_context* ctx) {
+	return ctx->cur < ctx->end ? (unsigned char) *ctx->cur++ : EOF;
 }
 
-static int peek() {
-	int c = fgetc(input_file);
-	ungetc(c, input_file);
-	return c;
+static int peek(struct tc_context* ctx) {
+	return ctx->cur < ctx->end ? (unsigned char) *ctx->cur : EOF;
 }
 
-static bool optional(int c) {
-	if (peek() == c)
-		return next() > 0;
+static bool optional(struct tc_context* ctx, int c) {
+	if (ctx->cur < ctx->end && (unsigned char) *ctx->cur == c) {
+		ctx->cur++;
+		return true;
+	}
 	return false;
 }
 
-static void expect(int c) {
-	if (next() != c)
-		error("invalid character. expected '%c'.\n", c);
+static void expect(struct tc_context* ctx, int c) {
+	if (next(ctx) != c)
+		error(ctx, "invalid character. expected '%c'.\n", c);
 }
 
-static int skipws() {
-	int c = next();
-	while (c == ' ' || c == '\t' || c == '\n' || c == '\r')
-		c = next();
-	return c;
+static void skipws(struct tc_context* ctx) {
+	ctx->cur = scan_space(ctx->cur, ctx->end);
 }
 
-static int skipto(char* to) {
-	int c = next();
-	while (strchr(to, c) == NULL)
-		c = next();
-	return c;
+static void skipline(struct tc_context* ctx) {
+	ctx->cur = scan_line(ctx->cur, ctx->end);
+	if (ctx->cur < ctx->end)
+		ctx->cur++;
+}
+
+static void skipcomment(struct tc_context* ctx) {
+	int comments = 1;
+	while (comments > 0) {
+		ctx->cur = scan_comment(ctx->cur, ctx->end);
+		if (ctx->end - ctx->cur < 2) {
+			ctx->cur = ctx->end;
+			error(ctx, "unterminated comment.\n");
+		}
+		if (ctx->cur[0] == '/' && ctx->cur[1] == '*') {
+			comments++;
+			ctx->cur += 2;
+		} else if (ctx->cur[0] == '*' && ctx->cur[1] == '/') {
+			comments--;
+			ctx->cur += 2;
+		} else {
+			ctx->cur++;
+		}
+	}
 }
 
 /*
  * Checking
  */
-static int isvarchar(int c) {
-	return isalnum(c) || c == '_';
-}
-
 static int to_number(int c) {
 	if (c >= 'a' && c <= 'f') return 10 + c - 'a';
 	if (c >= 'A' && c <= 'F') return 10 + c - 'A';
@@ -84,147 +89,160 @@ static int to_number(int c) {
 /*
  * Lexing
  */
-static long lex_number(int c, int base) {
+// asm blocks go straight to the output, unless the whole input is being
+// lexed ahead of the parser. then they are kept until lex_flush_asm() says
+// the code before them has been written
+struct asm_block {
+	int offset;
+	int length;
+};
+
+static void lex_asm(struct tc_context* ctx, int offset, int length) {
+	if (ctx->asm_blocks == NULL) {
+		fwrite(ctx->start + offset, 1, length, ctx->output_file);
+		return;
+	}
+	struct asm_block* b = arena_push(ctx->lex_arena, sizeof(struct asm_block));
+	b->offset = offset;
+	b->length = length;
+	vec_push(ctx->asm_blocks, b);
+}
+
+// writes out the asm blocks kept back that come before 'offset'
+void lex_flush_asm(struct tc_context* ctx, int offset) {
+	struct vec* blocks = ctx->asm_blocks;
+	if (blocks == NULL)
+		return;
+	for (; ctx->asm_next < blocks->size; ctx->asm_next++) {
+		struct asm_block* b = blocks->data[ctx->asm_next];
+		if (b->offset >= offset)
+			break;
+		fwrite(ctx->start + b->offset, 1, b->length, ctx->output_file);
+	}
+}
+
+static long lex_number(struct tc_context* ctx, int c, int base) {
 	long n = to_number(c);
-	while (to_number(peek()) != -1)
-		n = base * n + to_number(next());
+	while (to_number(peek(ctx)) != -1)
+		n = base * n + to_number(next(ctx));
 	return n;
 }
 
-static char* lex_word(int c) {
-	static char buffer[512];
-	int index = 0;
-	buffer[index++] = c;
-	while (isvarchar(peek()))
-		buffer[index++] = next();
-	buffer[index] = '\0';
-	return buffer;
+static void lex_word(struct tc_context* ctx) {
+	ctx->cur = scan_word(ctx->cur, ctx->end);
 }
 
-static char* lex_string() {
-	static char buffer[512];
-	int index = 0;
-	for (int c = next(); c != '"'; c = next()) {
-		if (c == '\\') {
-			switch (next()) {
-				case 'n': c = '\n'; break;
-			}
-		}
-		buffer[index++] = c;
+static void lex_string(struct tc_context* ctx) {
+	for (int c = next(ctx); c != '"'; c = next(ctx)) {
+		if (c == EOF)
+			error(ctx, "unterminated string.\n");
+		if (c == '\\')
+			next(ctx);
 	}
-	buffer[index] = '\0';
-	return buffer;
 }
 
-struct token* lex_token() {
-	// Skip whitespace
-	int c = skipws();
-	// Skip comments
-	while (c == '/') {
-		if (optional('/')) {
-			skipto("\n");
-		} else if (optional('*')) {
-			int comments = 1;
-			while (comments > 0) {
-				if (optional('/') && optional('*'))
-					comments++;
-				else if (optional('*') && optional('/'))
-					comments--;
-				else next();
-			}
+void lex_token(struct tc_context* ctx, struct token* t) {
+	// Skip whitespace and comments
+	for (;;) {
+		skipws(ctx);
+		if (ctx->end - ctx->cur < 2 || ctx->cur[0] != '/')
+			break;
+		if (ctx->cur[1] == '/') {
+			skipline(ctx);
+		} else if (ctx->cur[1] == '*') {
+			ctx->cur += 2;
+			skipcomment(ctx);
 		} else {
 			break;
 		}
-		c = skipws();
 	}
 
-	struct token* t = malloc(sizeof(struct token));
-	t->line = line;
-	t->line_index = line_index;
+	t->offset = ctx->cur - ctx->start;
 
+	int c = next(ctx);
 	switch (c) {
 		case EOF:
 			t->token = T_EOF;
 			break;
 		case '\'':
 			t->token = T_NUMBER;
-			t->number = next();
+			t->number = next(ctx);
 			if (t->number == '\\') {
-				switch (next()) {
+				switch (next(ctx)) {
 					case 'b': t->number = '\b'; break;
 					case 't': t->number = '\t'; break;
 					case 'n': t->number = '\n'; break;
 					case 'f': t->number = '\f'; break;
 					case 'r': t->number = '\r'; break;
 					default:
-						error("invalid escape sequence\n");
+						error(ctx, "invalid escape sequence\n");
 						break;
 				}
 			}
-			expect('\'');
+			expect(ctx, '\'');
 			break;
 		case '"':
 			t->token = T_STRING;
-			t->name = strdup(lex_string());
+			lex_string(ctx);
 			break;
 		case '0':
 			t->token = T_NUMBER;
-			if      (optional('b')) t->number = lex_number(next(), 2);
-			else if (optional('o')) t->number = lex_number(next(), 8);
-			else if (optional('x')) t->number = lex_number(next(), 16);
-			else                    t->number = lex_number(c,      10);
+			if      (optional(ctx, 'b')) t->number = lex_number(ctx, next(ctx), 2);
+			else if (optional(ctx, 'o')) t->number = lex_number(ctx, next(ctx), 8);
+			else if (optional(ctx, 'x')) t->number = lex_number(ctx, next(ctx), 16);
+			else                    t->number = lex_number(ctx, c,      10);
 			break;
 		case '1': case '2': case '3': case '4': case '5':
 		case '6': case '7': case '8': case '9':
 			t->token = T_NUMBER;
-			t->number = lex_number(c, 10);
+			t->number = lex_number(ctx, c, 10);
 			break;
 		case '>':
-			if (optional('=')) t->token = T_GE;
-			else if (optional('>')) {
-				if (optional('=')) t->token = T_SHR_ASSIGN;
+			if (optional(ctx, '=')) t->token = T_GE;
+			else if (optional(ctx, '>')) {
+				if (optional(ctx, '=')) t->token = T_SHR_ASSIGN;
 				else t->token = T_SHR;
 			} else t->token = c;
 			break;
 		case '<':
-			if (optional('=')) t->token = T_LE;
-			else if (optional('<')) {
-				if (optional('=')) t->token = T_SHL_ASSIGN;
+			if (optional(ctx, '=')) t->token = T_LE;
+			else if (optional(ctx, '<')) {
+				if (optional(ctx, '=')) t->token = T_SHL_ASSIGN;
 				else t->token = T_SHL;
 			} else t->token = c;
 			break;
 		case '+':
-			if (optional('=')) t->token = T_ADD_ASSIGN;
-			else if (optional('+')) t->token = T_INC;
+			if (optional(ctx, '=')) t->token = T_ADD_ASSIGN;
+			else if (optional(ctx, '+')) t->token = T_INC;
 			else t->token = c;
 			break;
 		case '-':
-			if (optional('=')) t->token = T_SUB_ASSIGN;
-			else if (optional('-')) t->token = T_DEC;
+			if (optional(ctx, '=')) t->token = T_SUB_ASSIGN;
+			else if (optional(ctx, '-')) t->token = T_DEC;
 			else t->token = c;
 			break;
 		case '*':
-			if (optional('=')) t->token = T_MUL_ASSIGN;
+			if (optional(ctx, '=')) t->token = T_MUL_ASSIGN;
 			else t->token = c;
 			break;
 		case '/':
-			if (optional('=')) t->token = T_DIV_ASSIGN;
+			if (optional(ctx, '=')) t->token = T_DIV_ASSIGN;
 			else t->token = c;
 			break;
 		case '&':
-			if (optional('=')) t->token = T_AND_ASSIGN;
+			if (optional(ctx, '=')) t->token = T_AND_ASSIGN;
 			else t->token = c;
 			break;
 		case '|':
-			if (optional('=')) t->token = T_OR_ASSIGN;
+			if (optional(ctx, '=')) t->token = T_OR_ASSIGN;
 			else t->token = c;
 			break;
 		case '=':
-			if (optional('=')) t->token = T_EQ;
+			if (optional(ctx, '=')) t->token = T_EQ;
 			else t->token = c;
 			break;
 		case '!':
-			if (optional('=')) t->token = T_NE;
+			if (optional(ctx, '=')) t->token = T_NE;
 			else t->token = c;
 			break;
 		case '{':
@@ -240,36 +258,420 @@ struct token* lex_token() {
 			break;
 		default: {
 			if (!isalpha(c) && c != '_')
-				error("invalid character '%c'.\n", c);
-			char* name = lex_word(c);
-			if (!strcmp(name, "asm")) {
-				c = skipws();
-				if (c != '{')
-					error("empty asm directive");
-				optional('\n');
-				while ((c = next()) != '}')
-					fputc(c, output_file);
-				free(t);
-				return lex_token();
-			} else if (token_type_fromstr(name) != T_EOF) {
-				t->token = token_type_fromstr(name);
-			} else if (type_fromstr(name) != 0) {
-				t->token = T_TYPE;
-				t->type = type_fromstr(name);
-			} else {
-				t->token = T_NAME;
-				t->name = strdup(name);
+				error(ctx, "invalid character '%c'.\n", c);
+			const char* name = ctx->cur - 1;
+			lex_word(ctx);
+			t->token = token_type_fromword(name, ctx->cur - name, &t->type);
+			if (t->token == T_NAME) {
+				t->ident = ctx->intern_later ? NULL : intern_get(ctx, name, ctx->cur - name);
+			} else if (t->token == T_ASM) {
+				skipws(ctx);
+				if (next(ctx) != '{')
+					error(ctx, "empty asm directive");
+				optional(ctx, '\n');
+				const char* close = memchr(ctx->cur, '}', ctx->end - ctx->cur);
+				if (close == NULL) {
+					ctx->cur = ctx->end;
+					error(ctx, "unterminated asm directive.\n");
+				}
+				lex_asm(ctx, ctx->cur - ctx->start, close - ctx->cur);
+				ctx->cur = close + 1;
+				return lex_token(ctx, t);
 			}
 			break;
 		}
 	}
-	return t;
+	t->length = ctx->cur - ctx->start - t->offset;
+}
+
+// copies the contents of the string literal of length 'length' at 'offset'
+// out of the source buffer, resolving escape sequences.
+char* lex_getstring(struct tc_context* ctx, int offset, int length, struct arena* a) {
+	const char* s = ctx->start + offset + 1;
+	const char* e = ctx->start + offset + length - 1;
+	char* buffer = arena_push(a, e - s + 1);
+	int index = 0;
+	while (s < e) {
+		int c = *s++;
+		if (c == '\\') {
+			switch (*s++) {
+				case 'n': c = '\n'; break;
+			}
+		}
+		buffer[index++] = c;
+	}
+	buffer[index] = '\0';
+	return buffer;
+}
+
+static void lex_init(struct tc_context* ctx) {
+	ctx->start = ctx->cur = ctx->input_source->data;
+	ctx->end = ctx->start + ctx->input_source->size;
+}
+
+// lexes the whole input at once, keeping the tokens in 'a'
+struct tokens* lex(struct tc_context* ctx, struct arena* a) {
+	lex_init(ctx);
+
+	struct tokens* ts = tokens_alloc(a);
+	struct token t;
+	do {
+		lex_token(ctx, &t);
+		tokens_push(ts, &t);
+	} while (t.token != T_EOF);
+	return ts;
+}
+
+// starts lexing the input on demand, keeping only the last 'window' tokens
+struct tokens* lex_stream(struct tc_context* ctx, struct arena* a, int window) {
+	lex_init(ctx);
+	return tokens_alloc_ring(a, window, lex_token, ctx);
+}
+
+/*
+ * Pipelining
+ */
+#define PIPE_CHUNK 512
+#define PIPE_DEPTH 8
+
+// Tokens handed from the lexer thread to the parser. The asm blocks met
+// while lexing them are written out as the parser gets to the tokens that
+// follow, just as when lexing on demand
+struct lex_chunk {
+	struct token tokens[PIPE_CHUNK];
+	int count;
+	struct vec* asm_blocks;
+	// lexing stopped at an error after the last token
+	bool failed;
+};
+
+// A single producer, single consumer queue of chunks. The lexer publishes
+// chunk 'tail' once it is full and the parser gives chunk 'head' back once
+// it has read it, so each side only ever writes its own counter
+struct lex_pipe {
+	struct tc_context lexer;
+	pthread_t thread;
+	struct lex_chunk chunks[PIPE_DEPTH];
+	atomic_int head;
+	atomic_int tail;
+	atomic_bool stop;
+	// CPU time the lexer thread took, once it has finished
+	double cpu;
+
+	// the parser's side
+	struct lex_chunk* chunk;
+	int index;
+};
+
+static void lex_pipe_lex(struct lex_pipe* pipe) {
+	struct tc_context* ctx = &pipe->lexer;
+	for (int n = 0;; n++) {
+		while (n - atomic_load_explicit(&pipe->head, memory_order_acquire) == PIPE_DEPTH) {
+			if (atomic_load_explicit(&pipe->stop, memory_order_relaxed))
+				return;
+			sched_yield();
+		}
+		struct lex_chunk* c = &pipe->chunks[n % PIPE_DEPTH];
+		c->count = 0;
+		c->failed = false;
+		c->asm_blocks = ctx->asm_blocks = vec_alloc(ctx->lex_arena);
+		if (setjmp(ctx->on_error)) {
+			c->failed = true;
+			atomic_store_explicit(&pipe->tail, n + 1, memory_order_release);
+			return;
+		}
+		struct token t;
+		do {
+			lex_token(ctx, &t);
+			c->tokens[c->count++] = t;
+		} while (t.token != T_EOF && c->count < PIPE_CHUNK);
+		atomic_store_explicit(&pipe->tail, n + 1, memory_order_release);
+		if (t.token == T_EOF)
+			return;
+	}
+}
+
+static void* lex_pipe_run(void* p) {
+	struct lex_pipe* pipe = p;
+	lex_pipe_lex(pipe);
+	struct trace_time now;
+	trace_now(&now);
+	pipe->cpu = now.cpu;
+	return NULL;
+}
+
+static void lex_pipe_pull(struct tc_context* ctx, struct token* t) {
+	struct lex_pipe* pipe = ctx->pipe;
+	while (pipe->chunk == NULL || pipe->index == pipe->chunk->count) {
+		if (pipe->chunk != NULL) {
+			if (pipe->chunk->failed) {
+				memcpy(ctx->error, pipe->lexer.error, sizeof(ctx->error));
+				longjmp(ctx->on_error, 1);
+			}
+			atomic_fetch_add_explicit(&pipe->head, 1, memory_order_release);
+		}
+		int head = atomic_load_explicit(&pipe->head, memory_order_relaxed);
+		while (atomic_load_explicit(&pipe->tail, memory_order_acquire) == head)
+			sched_yield();
+		pipe->chunk = &pipe->chunks[head % PIPE_DEPTH];
+		pipe->index = 0;
+		ctx->asm_blocks = pipe->chunk->asm_blocks;
+		ctx->asm_next = 0;
+	}
+	*t = pipe->chunk->tokens[pipe->index++];
+	lex_flush_asm(ctx, t->offset);
+}
+
+// starts lexing the input on a thread of its own, running ahead of the
+// reader by up to a few chunks of tokens. the reader keeps the last
+// 'window' of them, as with lex_stream()
+struct tokens* lex_pipe(struct tc_context* ctx, struct arena* a, int window) {
+	lex_init(ctx);
+	struct lex_pipe* pipe = malloc(sizeof(struct lex_pipe));
+	memcpy(&pipe->lexer, ctx, sizeof(struct tc_context));
+	pipe->lexer.lex_arena = arena_alloc();
+	atomic_init(&pipe->head, 0);
+	atomic_init(&pipe->tail, 0);
+	atomic_init(&pipe->stop, false);
+	pipe->chunk = NULL;
+	pipe->index = 0;
+	pipe->cpu = 0;
+	ctx->pipe = pipe;
+	pthread_create(&pipe->thread, NULL, lex_pipe_run, pipe);
+	return tokens_alloc_ring(a, window, lex_pipe_pull, ctx);
+}
+
+// waits for the lexer thread, wherever the reader stopped, and takes back
+// the identifiers it interned
+void lex_pipe_stop(struct tc_context* ctx) {
+	struct lex_pipe* pipe = ctx->pipe;
+	if (pipe == NULL)
+		return;
+	atomic_store_explicit(&pipe->stop, true, memory_order_relaxed);
+	pthread_join(pipe->thread, NULL);
+	if (ctx->options.time_report != NULL)
+		ctx->phase_times[PHASE_LEX].cpu += pipe->cpu;
+	ctx->ident_table = pipe->lexer.ident_table;
+	ctx->ident_capacity = pipe->lexer.ident_capacity;
+	ctx->ident_count = pipe->lexer.ident_count;
+	arena_free(pipe->lexer.lex_arena);
+	free(pipe);
+	ctx->pipe = NULL;
+}
+
+/*
+ * Splitting
+ */
+// Parts smaller than this aren't worth a thread
+#define PART_MIN_SIZE (64 * 1024)
+
+// A stretch of the input lexed on its own, from 'start' up to the first
+// token at or past 'limit'. 'stop' is where that token starts, which is
+// where the next part has to pick up
+struct lex_part {
+	int start, limit, stop;
+	struct arena* arena;
+	struct tokens* tokens;
+	struct vec* asm_blocks;
+	bool failed;
+	char* error;
+};
+
+struct lex_part_pool {
+	struct tc_context* ctx;
+	struct lex_part* parts;
+	int part_count;
+	atomic_int next;
+};
+
+static bool ishex(int c) {
+	return to_number(c) != -1;
+}
+
+// picks where to split the input into 'count' parts: at the start of lines
+// outside any comment, string, character or asm block, so that each part
+// starts on a token. this skips over the input as the lexer would without
+// making tokens. returns how many parts there are, fewer if the input runs
+// out of such lines
+static int lex_split(struct tc_context* ctx, int* bounds, int count) {
+	const char* start = ctx->start;
+	const char* end = ctx->end;
+	const char* p = start;
+	long size = end - start;
+	int n = 1;
+	bounds[0] = 0;
+	const char* target = start + size / count;
+	while (p < end && n < count) {
+		int c = (unsigned char) *p;
+		if (c == '\n') {
+			p++;
+			if (p >= target && p < end) {
+				bounds[n++] = p - start;
+				target = start + size * n / count;
+			}
+		} else if (c == '/' && end - p >= 2 && p[1] == '/') {
+			p = scan_line(p, end);
+		} else if (c == '/' && end - p >= 2 && p[1] == '*') {
+			p += 2;
+			for (int comments = 1; comments > 0;) {
+				p = scan_comment(p, end);
+				if (end - p < 2)
+					return n;
+				if (p[0] == '/' && p[1] == '*') {
+					comments++;
+					p += 2;
+				} else if (p[0] == '*' && p[1] == '/') {
+					comments--;
+					p += 2;
+				} else {
+					p++;
+				}
+			}
+		} else if (c == '"') {
+			for (p++; p < end && *p != '"'; p++) {
+				if (*p == '\\')
+					p++;
+			}
+			if (p >= end)
+				return n;
+			p++;
+		} else if (c == '\'') {
+			p++;
+			if (p < end && *p++ == '\\')
+				p++;
+			p = p + 1 < end ? p + 1 : end;
+		} else if (c >= '0' && c <= '9') {
+			p++;
+			if (c == '0' && p < end && (*p == 'b' || *p == 'o' || *p == 'x'))
+				p += 2;
+			while (p < end && ishex(*p))
+				p++;
+		} else if (isalpha(c) || c == '_') {
+			const char* word = p;
+			p = scan_word(p, end);
+			if (p - word == 3 && !memcmp(word, "asm", 3)) {
+				p = scan_space(p, end);
+				if (p == end || *p != '{')
+					return n;
+				const char* close = memchr(p, '}', end - p);
+				if (close == NULL)
+					return n;
+				p = close + 1;
+			}
+		} else {
+			p++;
+		}
+	}
+	return n;
 }
 
-struct vec* lex() {
-	struct vec* v = vec_alloc();
-	struct token* t;
-	do vec_push(v, t = lex_token());
-	while (t->token != T_EOF);
-	return v;
+static void lex_part_run(struct tc_context* ctx, struct lex_part* part) {
+	struct tc_context local;
+	memcpy(&local, ctx, sizeof(struct tc_context));
+	local.cur = local.start + part->start;
+	local.lex_arena = part->arena;
+	local.asm_blocks = part->asm_blocks = vec_alloc(part->arena);
+	local.intern_later = true;
+	part->tokens = tokens_alloc(part->arena);
+	part->failed = false;
+	if (setjmp(local.on_error)) {
+		part->failed = true;
+		part->error = arena_push(part->arena, strlen(local.error) + 1);
+		strcpy(part->error, local.error);
+		return;
+	}
+	struct token t;
+	for (;;) {
+		lex_token(&local, &t);
+		if (t.offset >= part->limit) {
+			part->stop = t.offset;
+			return;
+		}
+		tokens_push(part->tokens, &t);
+		if (t.token == T_EOF)
+			return;
+	}
+}
+
+static void* lex_part_worker(void* p) {
+	struct lex_part_pool* pool = p;
+	for (int i; (i = atomic_fetch_add(&pool->next, 1)) < pool->part_count;)
+		lex_part_run(pool->ctx, &pool->parts[i]);
+	return NULL;
+}
+
+// lexes the whole input at once like lex(), split into parts lexed on up to
+// 'threads' threads. the parts are then joined in order, interning the
+// identifiers as they go so they are numbered as lex() would
+struct tokens* lex_parallel(struct tc_context* ctx, struct arena* a, int threads) {
+	lex_init(ctx);
+	int count = threads;
+	if (count > (ctx->end - ctx->start) / PART_MIN_SIZE)
+		count = (ctx->end - ctx->start) / PART_MIN_SIZE;
+	if (count <= 1)
+		return lex(ctx, a);
+
+	int* bounds = malloc(count * sizeof(int));
+	count = lex_split(ctx, bounds, count);
+	struct lex_part* parts = malloc(count * sizeof(struct lex_part));
+	for (int i = 0; i < count; i++) {
+		parts[i].start = bounds[i];
+		parts[i].limit = i + 1 < count ? bounds[i + 1] : INT_MAX;
+		parts[i].arena = arena_alloc();
+	}
+	free(bounds);
+	struct lex_part_pool pool = { ctx, parts, count, 0 };
+	trace_cpu(ctx, pool_run(threads < count ? threads : count, lex_part_worker, &pool));
+
+	struct tokens* ts = tokens_alloc(a);
+	int pos = 0;
+	bool failed = false;
+	for (int i = 0; i < count && !failed; i++) {
+		struct lex_part* part = &parts[i];
+		// a part that doesn't start where the last one stopped was split
+		// inside something, which only input the lexer rejects can do. the
+		// rest is lexed in one piece instead
+		if (i > 0 && (part->tokens->count == 0 || part->tokens->offsets[0] != pos)) {
+			part->start = pos;
+			part->limit = INT_MAX;
+			lex_part_run(ctx, part);
+			count = i + 1;
+		}
+
+		for (int j = 0, v = 0; j < part->tokens->count; j++) {
+			struct token t = { .offset = part->tokens->offsets[j], .token = part->tokens->kinds[j] };
+			if (token_hasvalue(t.token)) {
+				union token_value value = part->tokens->values[v++];
+				switch (t.token) {
+					case T_NUMBER: t.number = value.number; break;
+					case T_STRING: t.length = value.length; break;
+					case T_TYPE: t.type = value.type; break;
+					case T_NAME: {
+						const char* name = ctx->start + t.offset;
+						t.ident = intern_get(ctx, name, scan_word(name, ctx->end) - name);
+						break;
+					}
+				}
+			}
+			tokens_push(ts, &t);
+		}
+		// the asm blocks before its first token went with the last part
+		for (int j = 0; j < part->asm_blocks->size; j++) {
+			struct asm_block* b = part->asm_blocks->data[j];
+			if (b->offset >= pos)
+				lex_asm(ctx, b->offset, b->length);
+		}
+		if (part->failed) {
+			memcpy(ctx->error, part->error, strlen(part->error) + 1);
+			failed = true;
+		}
+		pos = part->stop;
+	}
+
+	for (int i = 0; i < pool.part_count; i++)
+		arena_free(parts[i].arena);
+	free(parts);
+	if (failed)
+		longjmp(ctx->on_error, 1);
+	return ts;
 }
@@ -1,45 +1,170 @@
-#include <ctype.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
-#include "gen.h"
-#include "lexer.h"
-#include "parser.h"
-#include "token.h"
-#include "vec.h"
+#include "pool.h"
+#include "tc.h"
 
-char* input_filename;
-FILE* input_file;
+struct job {
+	const char* input;
+	char* output;
+	int status;
+	char* error;
+	double seconds;
+};
 
-char* output_filename;
-FILE* output_file;
+// Workers take the next job off the list until there are none left, each
+// with a context of its own
+struct pool {
+	struct tc_options options;
+	struct job* jobs;
+	int job_count;
+	atomic_int next;
+};
+
+static double now() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// 'dir/name.ts' for 'path/to/name.tc', or 'path/to/name.ts' with no 'dir'
+static char* output_name(const char* input, const char* dir) {
+	const char* base = input;
+	if (dir != NULL) {
+		const char* slash = strrchr(input, '/');
+		if (slash != NULL)
+			base = slash + 1;
+	}
+	char* output = malloc((dir ? strlen(dir) + 1 : 0) + strlen(base) + 1);
+	if (dir != NULL)
+		sprintf(output, "%s/%s", dir, base);
+	else
+		strcpy(output, base);
+	output[strlen(output) - 1] = 's';
+	return output;
+}
+
+static void* worker(void* p) {
+	struct pool* pool = p;
+	struct tc_context* ctx = tc_alloc(&pool->options);
+	for (int i; (i = atomic_fetch_add(&pool->next, 1)) < pool->job_count;) {
+		struct job* job = &pool->jobs[i];
+		double start = now();
+		job->status = tc_compile(ctx, job->input, job->output);
+		job->seconds = now() - start;
+		if (job->status != 0)
+			job->error = strdup(tc_geterror(ctx));
+	}
+	tc_free(ctx);
+	return NULL;
+}
+
+static void usage(const char* name) {
+	fprintf(stderr, "Usage: %s [-j threads] [-o directory] [--gen-threads=n] [--parse-threads=n] [--lex-threads=n]\n"
+			"       [--lex-thread] [--lazy] [--root=name]... [-ftime-report] [--trace=file.json]\n"
+			"       file...\n", name);
+}
 
 int main(int argc, char **argv) {
-	if (argc != 2) {
-		fprintf(stderr, "Usage: %s file\n", argv[0]);
+	int thread_count = 1;
+	const char* output_dir = NULL;
+	struct pool pool = { { .gen_threads = 1, .parse_threads = 1, .lex_threads = 1 },
+		malloc(argc * sizeof(struct job)), 0, 0 };
+	const char** roots = calloc(argc, sizeof(char*));
+	int root_count = 0;
+	const char* trace_path = NULL;
+	pool.options.roots = roots;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-j") || !strcmp(argv[i], "-o")) {
+			if (i + 1 == argc) {
+				usage(argv[0]);
+				return 1;
+			}
+			if (argv[i][1] == 'j')
+				thread_count = atoi(argv[++i]);
+			else
+				output_dir = argv[++i];
+		} else if (!strncmp(argv[i], "-j", 2)) {
+			thread_count = atoi(argv[i] + 2);
+		} else if (!strncmp(argv[i], "--gen-threads=", 14)) {
+			pool.options.gen_threads = atoi(argv[i] + 14);
+		} else if (!strcmp(argv[i], "-ftime-report")) {
+			pool.options.time_report = stderr;
+		} else if (!strncmp(argv[i], "--trace=", 8)) {
+			trace_path = argv[i] + 8;
+		} else if (!strcmp(argv[i], "--lazy")) {
+			pool.options.lazy = 1;
+		} else if (!strncmp(argv[i], "--root=", 7)) {
+			roots[root_count++] = argv[i] + 7;
+		} else if (!strcmp(argv[i], "--lex-thread")) {
+			pool.options.lex_thread = 1;
+		} else if (!strncmp(argv[i], "--lex-threads=", 14)) {
+			pool.options.lex_threads = atoi(argv[i] + 14);
+		} else if (!strncmp(argv[i], "--parse-threads=", 16)) {
+			pool.options.parse_threads = atoi(argv[i] + 16);
+		} else {
+			pool.jobs[pool.job_count++] = (struct job) { argv[i], NULL, 0, NULL, 0 };
+		}
+	}
+	if (pool.job_count == 0 || thread_count < 1 || pool.options.gen_threads < 1 ||
+			pool.options.parse_threads < 1 || pool.options.lex_threads < 1) {
+		usage(argv[0]);
 		return 1;
 	}
+	if (thread_count > pool.job_count)
+		thread_count = pool.job_count;
 
-	input_filename = argv[1];
-	input_file = fopen(input_filename, "r");
-	if (input_file == NULL) {
-		printf("Error opening file '%s' for reading.\n", input_filename);
-		return 1;
+	if (trace_path != NULL) {
+		pool.options.trace = tc_trace_open(trace_path);
+		if (pool.options.trace == NULL) {
+			fprintf(stderr, "%s: error: couldn't open '%s' for writing.\n", argv[0], trace_path);
+			return 1;
+		}
 	}
 
-	output_filename = strdup(argv[1]);
-	output_filename[strlen(output_filename) - 1] = 's';
-	output_file = fopen(output_filename, "w");
-	if (output_file == NULL) {
-		printf("Error opening file '%s' for writing.\n", output_filename);
-		fclose(input_file);
-		return 1;
+	for (int i = 0; i < pool.job_count; i++)
+		pool.jobs[i].output = output_name(pool.jobs[i].input, output_dir);
+
+	double start = now();
+	pool_run(thread_count, worker, &pool);
+	double wall = now() - start;
+
+	// Errors come out in the order the files were given, whichever worker
+	// got to them first
+	int failed = 0;
+	double busy = 0;
+	for (int i = 0; i < pool.job_count; i++) {
+		struct job* job = &pool.jobs[i];
+		if (job->status != 0) {
+			fprintf(stderr, "%s", job->error);
+			failed++;
+		}
+		busy += job->seconds;
 	}
 
-	gen(parse(lex()));
+	if (pool.job_count > 1) {
+		for (int i = 0; i < pool.job_count; i++) {
+			struct job* job = &pool.jobs[i];
+			fprintf(stderr, "%10.2f ms  %s%s\n", job->seconds * 1e3, job->input,
+					job->status != 0 ? " (failed)" : "");
+		}
+		fprintf(stderr, "%d files, %d failed, %.2f ms on %d threads, %.2f ms compiling\n",
+				pool.job_count, failed, wall * 1e3, thread_count, busy * 1e3);
+	}
 
-	fclose(input_file);
-	fclose(output_file);
-	return 0;
+	for (int i = 0; i < pool.job_count; i++) {
+		free(pool.jobs[i].output);
+		free(pool.jobs[i].error);
+	}
+	free(pool.jobs);
+	free(roots);
+	if (pool.options.trace != NULL && tc_trace_close(pool.options.trace) != 0) {
+		fprintf(stderr, "%s: error: couldn't write '%s'.\n", argv[0], trace_path);
+		failed++;
+	}
+	return failed != 0;
 }
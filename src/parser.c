@@ -1,93 +1,235 @@
 #include "parser.h"
 
+#include <limits.h>
+#include <setjmp.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "context.h"
 #include "lexer.h"
+#include "pool.h"
 #include "sym.h"
 #include "token.h"
 #include "vec.h"
 
-static struct vec* tokens;
-static int current_token = 0;
+static _Noreturn void error(struct tc_context* ctx, int t, const char* format, ...) {
+	va_list args;
+	va_start(args, format);
+	tc_verror(ctx, tokens_offset(ctx->tokens, t), format, args);
+}
 
-extern char* input_filename;
-static void error(struct token* t, const char* format, ...) {
+// an error at 'offset' in the source. a token kept for a later error is
+// kept by offset, since the ring may drop it while parsing what follows
+static _Noreturn void error_at(struct tc_context* ctx, int offset, const char* format, ...) {
 	va_list args;
 	va_start(args, format);
-	fprintf(stderr, "%s:%d:%d: error: ", input_filename, t->line, t->line_index);
-	vfprintf(stderr, format, args);
-	va_end(args);
-	exit(1);
+	tc_verror(ctx, offset, format, args);
 }
 
-static void type_error(struct token* t, int old, int new) {
-	error(t, "can't convert %s to %s.\n",
-			strdup(type_tostr(old)), strdup(type_tostr(new)));
+static _Noreturn void type_error(struct tc_context* ctx, int t, int old, int new) {
+	char buffer[128];
+	snprintf(buffer, sizeof(buffer), "%s", type_tostr(old));
+	error(ctx, t, "can't convert %s to %s.\n", buffer, type_tostr(new));
 }
 
-static void token_error(struct token* t, int expected) {
+static _Noreturn void token_error(struct tc_context* ctx, int t, int expected) {
+	int kind = tokens_kind(ctx->tokens, t);
 	if (expected != 0) {
-		error(t, "expected '%s' (%d), got '%s' (%d).\n", token_type_tostr(expected),
-				expected, strdup(token_type_tostr(t->token)), t->token);
+		char buffer[16];
+		snprintf(buffer, sizeof(buffer), "%s", token_type_tostr(kind));
+		error(ctx, t, "expected '%s' (%d), got '%s' (%d).\n", token_type_tostr(expected),
+				expected, buffer, kind);
 	} else {
-		error(t, "invalid token '%s'.\n", token_type_tostr(t->token));
+		error(ctx, t, "invalid token '%s'.\n", token_type_tostr(kind));
 	}
 }
 
-static struct token* prev() {
-	return tokens->data[--current_token];
+// the type 'type' points to, as a dereference at 'offset' in the source
+static int deref_type(struct tc_context* ctx, int offset, int type) {
+	if (type_getpointer(type) == 0)
+		error_at(ctx, offset, "can't dereference %s.\n", type_tostr(type));
+	return type_fromptr(type);
 }
 
-static struct token* next() {
-	return tokens->data[current_token++];
+// the index of the last token consumed, for error locations
+static int prev(struct tc_context* ctx) {
+	return ctx->current_token - 1;
 }
 
-static struct token* peek() {
-	return tokens->data[current_token];
+static int next(struct tc_context* ctx) {
+	int kind = tokens_kind(ctx->tokens, ctx->current_token++);
+	if (token_hasvalue(kind))
+		ctx->current_value++;
+	return kind;
 }
 
-static struct token* lookahead(int n) {
-	return tokens->data[current_token + n];
+static int peek(struct tc_context* ctx) {
+	return tokens_kind(ctx->tokens, ctx->current_token);
 }
 
-static bool optional(int token) {
-	if (peek()->token == token)
-		 return next() != NULL;
+static int lookahead(struct tc_context* ctx, int n) {
+	return tokens_kind(ctx->tokens, ctx->current_token + n);
+}
+
+static bool optional(struct tc_context* ctx, int token) {
+	if (peek(ctx) == token)
+		return next(ctx);
 	return false;
 }
 
-static struct token* expect(int token) {
-	struct token* t = next();
-	if (t->token != token)
-		token_error(t, token);
-	return t;
+// consumes a token of kind 'token' and returns its value, if it has one
+static union token_value expect(struct tc_context* ctx, int token) {
+	if (next(ctx) != token)
+		token_error(ctx, prev(ctx), token);
+	union token_value v = { 0 };
+	if (token_hasvalue(token))
+		v = tokens_value(ctx->tokens, ctx->current_value - 1);
+	return v;
+}
+
+// tree nodes and symbols are counted as they are made, for the time report
+static void* node_alloc(struct tc_context* ctx, size_t size) {
+	ctx->node_count++;
+	return arena_push(ctx->arena, size);
+}
+
+static struct sym* symbol_alloc(struct tc_context* ctx, struct arena* a, enum sym_type sym_type) {
+	ctx->sym_count++;
+	return sym_alloc(a, sym_type);
 }
 
 /*
  * Expressions
  */
-struct expr* expr_scale(struct expr* e, int factor) {
-	struct expr* x = malloc(sizeof(struct expr));
+// whether evaluating 'e' does nothing but give its value
+static bool expr_ispure(struct expr* e) {
+	switch (e->expr_type) {
+		case EXPR_NUMBER: case EXPR_STRING: case EXPR_NAME:
+			return true;
+		case EXPR_CALL: case EXPR_ASSIGN:
+			return false;
+		case EXPR_CAST: case EXPR_DEREF:
+			return expr_ispure(e->unop);
+		default:
+			return expr_ispure(e->binop.left) && expr_ispure(e->binop.right);
+	}
+}
+
+// 'n' truncated to 'type' and extended back to 64 bits, as a cast does
+static long expr_cast_value(long n, int type) {
+	switch (type_getsize(type)) {
+		case 1: return type_issigned(type) ? (long) (signed char) n : (long) (unsigned char) n;
+		case 2: return type_issigned(type) ? (long) (short) n : (long) (unsigned short) n;
+		case 4: return type_issigned(type) ? (long) (int) n : (long) (unsigned int) n;
+		default: return n;
+	}
+}
+
+// Folds 'e' once its operands have been folded: an operation on constants
+// is replaced by its value, computed the way the generated code would, in
+// 64 bits with signed comparisons and division
+static struct expr* expr_fold(struct expr* e) {
+	if (e->expr_type == EXPR_CAST) {
+		if (e->unop->expr_type == EXPR_NUMBER) {
+			e->number = expr_cast_value(e->unop->number, e->type);
+			e->expr_type = EXPR_NUMBER;
+		}
+		return e;
+	}
+	if (e->expr_type < EXPR_ADD || e->expr_type > EXPR_GTE)
+		return e;
+
+	struct expr* l = e->binop.left;
+	struct expr* r = e->binop.right;
+	if (l->expr_type == EXPR_NUMBER && r->expr_type == EXPR_NUMBER) {
+		// wrapping arithmetic is done unsigned
+		unsigned long a = l->number, b = r->number;
+		long n;
+		switch (e->expr_type) {
+			case EXPR_ADD: n = a + b; break;
+			case EXPR_SUB: n = a - b; break;
+			case EXPR_MUL: n = a * b; break;
+			case EXPR_DIV:
+				// left to fault at run time
+				if (b == 0 || (l->number == LONG_MIN && r->number == -1))
+					return e;
+				n = l->number / r->number;
+				break;
+			case EXPR_AND: n = a & b; break;
+			case EXPR_OR: n = a | b; break;
+			// the count is taken modulo 64, like the instructions do
+			case EXPR_SHL: n = a << (b & 63); break;
+			case EXPR_SHR: n = a >> (b & 63); break;
+			case EXPR_EQ: n = l->number == r->number; break;
+			case EXPR_NEQ: n = l->number != r->number; break;
+			case EXPR_LT: n = l->number < r->number; break;
+			case EXPR_GT: n = l->number > r->number; break;
+			case EXPR_LTE: n = l->number <= r->number; break;
+			case EXPR_GTE: n = l->number >= r->number; break;
+			default: return e;
+		}
+		e->expr_type = EXPR_NUMBER;
+		e->number = n;
+	}
+	return e;
+}
+
+// 'e' where only its value matters: as an operand, or as a whole
+// expression. x op c and c op x drop the constant there when it makes no
+// difference, as long as x has the same type so nothing type checked
+// against 'e' changes. Anywhere else, like a parenthesized expression
+// followed by '=', 'e' has to stay as it is to still be rejected.
+static struct expr* expr_value(struct expr* e) {
+	if (e->expr_type < EXPR_ADD || e->expr_type > EXPR_GTE)
+		return e;
+	enum expr_type et = e->expr_type;
+	bool commutes = et == EXPR_ADD || et == EXPR_MUL || et == EXPR_AND || et == EXPR_OR;
+	struct expr* l = e->binop.left;
+	struct expr* r = e->binop.right;
+	struct expr* x = l;
+	struct expr* c = r;
+	if (commutes && l->expr_type == EXPR_NUMBER) {
+		x = r;
+		c = l;
+	}
+	if (c->expr_type != EXPR_NUMBER)
+		return e;
+	if (c->number == 0 && (et == EXPR_MUL || et == EXPR_AND) && expr_ispure(x)) {
+		e->expr_type = EXPR_NUMBER;
+		e->number = 0;
+		return e;
+	}
+	bool identity = c->number == 1 ? et == EXPR_MUL || (et == EXPR_DIV && c == r) :
+		c->number == 0 ? et == EXPR_ADD || et == EXPR_OR || (c == r && (et == EXPR_SUB ||
+				et == EXPR_SHL || et == EXPR_SHR)) : false;
+	return identity && x->type == e->type ? x : e;
+}
+
+// 'e' times the size of what a pointer points to, for pointer arithmetic
+struct expr* expr_scale(struct tc_context* ctx, struct expr* e, int factor) {
+	if (factor == 1)
+		return e;
+	struct expr* x = node_alloc(ctx, sizeof(struct expr));
 	x->expr_type = EXPR_MUL;
+	x->type = e->type;
 	x->binop.left = e;
-	x->binop.left->parent = x;
-	x->binop.right = malloc(sizeof(struct expr));
-	x->binop.right->parent = x;
+	x->binop.right = node_alloc(ctx, sizeof(struct expr));
 	x->binop.right->expr_type = EXPR_NUMBER;
+	x->binop.right->type = type_fromint(factor);
 	x->binop.right->number = factor;
-	return x;
+	return expr_fold(x);
 }
 
 // type
 //	: s0 | u0 | s1 | u1 | s8 | u8 | s16 | u16 | s32 | u32 | s64 | u64
 //	| type '*'
-int parse_type() {
-	int t = expect(T_TYPE)->type;
-	while (optional('*'))
+int parse_type(struct tc_context* ctx) {
+	int t = expect(ctx, T_TYPE).type;
+	while (optional(ctx, '*'))
 		t = type_toptr(t);
 	return t;
 }
@@ -97,41 +239,56 @@ int parse_type() {
 //	| NUMBER
 //	| STRING
 //	| '(' expr ')'
-struct expr* parse_primary_expr(struct symtable* st) {
-	struct expr* e = malloc(sizeof(struct expr));
-	switch (peek()->token) {
+struct expr* parse_primary_expr(struct tc_context* ctx, struct symtable* st) {
+	struct expr* e = node_alloc(ctx, sizeof(struct expr));
+	switch (peek(ctx)) {
 		case T_NAME: {
 			e->expr_type = EXPR_NAME;
-			e->name = expect(T_NAME)->name;
-			struct sym* s = sym_get(st, e->name);
-			if (s == NULL)
-				error(prev(), "couldn't find variable '%s'.\n", e->name);
-			e->type = s->type;
+			struct ident* ident = expect(ctx, T_NAME).ident;
+			e->sym = sym_get(st, ident);
+			// with bodies parsed out of order, the root scope already has
+			// what is declared after this function
+			if (e->sym != NULL && (e->sym->sym_type == SYM_FUNC || e->sym->sym_type == SYM_GLOBAL) &&
+					e->sym->index >= ctx->root_visible)
+				e->sym = NULL;
+			if (e->sym == NULL)
+				error(ctx, prev(ctx), "couldn't find variable '%s'.\n", ident->name);
+			e->type = e->sym->type;
 			} break;
 		case T_NUMBER:
 			e->expr_type = EXPR_NUMBER;
-			e->number = expect(T_NUMBER)->number;
+			e->number = expect(ctx, T_NUMBER).number;
 			e->type = type_fromint(e->number);
 			break;
 		case T_STRING: {
-			static long string_count = 0;
-			struct sym* s = sym_alloc(SYM_STRING);
-			s->offset = (int) string_count;
-			s->name = expect(T_STRING)->name;
-			sym_put(symtable_get_root(st), s);
+			// strings outlive the function using them, so they go with the
+			// root scope rather than the tree. while bodies are parsed in
+			// parallel the root can't change, so they are put aside and
+			// numbered afterwards
+			struct symtable* root = symtable_get_root(st);
+			struct arena* a = ctx->strings != NULL ? ctx->arena : root->arena;
+			struct sym* s = symbol_alloc(ctx, a, SYM_STRING);
+			int offset = tokens_offset(ctx->tokens, ctx->current_token);
+			s->name = lex_getstring(ctx, offset, expect(ctx, T_STRING).length, a);
+			if (ctx->strings != NULL) {
+				vec_push(ctx->strings, s);
+			} else {
+				s->offset = ctx->string_count++;
+				sym_put(root, s);
+			}
 
 			e->expr_type = EXPR_STRING;
-			e->number = string_count++;
-			e->name = s->name;
+			e->sym = s;
 			e->type = type_toptr(TYPE_8 | TYPE_SIGNED);
 			} break;
 		case '(':
-			expect('(');
-			e = parse_expr(st);
-			expect(')');
+			// left as parsed, in case it is followed by '=' or a call
+			expect(ctx, '(');
+			e = parse_assign_expr(ctx, st);
+			expect(ctx, ')');
 			break;
 		default:
-			token_error(peek(), 0);
+			token_error(ctx, ctx->current_token, 0);
 			break;
 	}
 	return e;
@@ -141,44 +298,41 @@ struct expr* parse_primary_expr(struct symtable* st) {
 //	: primary_expr
 //	| postfix_expr '[' expr ']'
 //	| postfix_expr '(' assign_expr? (',' assign_expr)* ')'
-struct expr* parse_postfix_expr(struct symtable* st) {
-	struct expr* e = parse_primary_expr(st);
-	if (optional('(')) {
+struct expr* parse_postfix_expr(struct tc_context* ctx, struct symtable* st) {
+	struct expr* e = parse_primary_expr(ctx, st);
+	if (optional(ctx, '(')) {
 		if (e->expr_type != EXPR_NAME)
-			token_error(prev(), T_NAME);
-		struct expr* call = e;
-		e = malloc(sizeof(struct expr));
-		struct sym* s = sym_get(st, call->name);
-		e->type = s->type;
+			token_error(ctx, prev(ctx), T_NAME);
+		struct sym* s = e->sym;
 		e->expr_type = EXPR_CALL;
-		e->call.call = call;
-		e->call.call->parent = e;
-		e->call.args = vec_alloc();
+		e->type = s->type;
+		e->call.func = s;
+		if (ctx->calls != NULL)
+			vec_push(ctx->calls, s);
+		e->call.args = arena_push(ctx->arena, s->param_count * sizeof(struct expr*));
 		for (int i = 0; i < s->param_count; i++) {
-			struct expr* arg = parse_assign_expr(st);
+			struct expr* arg = expr_value(parse_assign_expr(ctx, st));
 			if (!type_fits(arg->type, s->params[i]))
-				type_error(prev(), arg->type, s->params[i]);
-			vec_push(e->call.args, arg);
+				type_error(ctx, prev(ctx), arg->type, s->params[i]);
+			e->call.args[i] = arg;
 			if (i != s->param_count - 1)
-				expect(',');
+				expect(ctx, ',');
 		}
-		expect(')');
-	} else if (optional('[')) {
+		expect(ctx, ')');
+	} else if (optional(ctx, '[')) {
 		if (e->expr_type != EXPR_NAME)
-			token_error(prev(), T_NAME);
+			token_error(ctx, prev(ctx), T_NAME);
 		struct expr* left = e;
-		e = malloc(sizeof(struct expr));
+		e = node_alloc(ctx, sizeof(struct expr));
 		e->expr_type = EXPR_DEREF;
-		e->type = type_fromptr(left->type);
-		e->unop = malloc(sizeof(struct expr));
-		e->unop->parent = e;
+		e->type = deref_type(ctx, tokens_offset(ctx->tokens, prev(ctx)), left->type);
+		e->unop = node_alloc(ctx, sizeof(struct expr));
 		e->unop->expr_type = EXPR_ADD;
 		e->unop->type = left->type;
 		e->unop->binop.left = left;
-		e->unop->binop.left->parent = e->unop;
-		e->unop->binop.right = expr_scale(parse_expr(st), type_getsize(e->type));
-		e->unop->binop.right->parent = e->unop;
-		expect(']');
+		e->unop->binop.right = expr_scale(ctx, parse_expr(ctx, st), type_getsize(e->type));
+		e->unop = expr_value(expr_fold(e->unop));
+		expect(ctx, ']');
 	}
 	return e;
 }
@@ -187,26 +341,26 @@ struct expr* parse_postfix_expr(struct symtable* st) {
 //	: postfix_expr
 //	| '*' cast_expr
 //	| 'sizeof' type
-struct expr* parse_unary_expr(struct symtable* st) {
+struct expr* parse_unary_expr(struct tc_context* ctx, struct symtable* st) {
 	struct expr* e;
-	switch (peek()->token) {
-		case '*':
-			expect('*');
-			e = malloc(sizeof(struct expr));
+	switch (peek(ctx)) {
+		case '*': {
+			int offset = tokens_offset(ctx->tokens, ctx->current_token);
+			expect(ctx, '*');
+			e = node_alloc(ctx, sizeof(struct expr));
 			e->expr_type = EXPR_DEREF;
-			e->unop = parse_cast_expr(st);
-			e->unop->parent = e;
-			e->type = type_fromptr(e->unop->type);
-			break;
+			e->unop = expr_value(parse_cast_expr(ctx, st));
+			e->type = deref_type(ctx, offset, e->unop->type);
+			} break;
 		case T_SIZEOF:
-			expect(T_SIZEOF);
-			e = malloc(sizeof(struct expr));
+			expect(ctx, T_SIZEOF);
+			e = node_alloc(ctx, sizeof(struct expr));
 			e->expr_type = EXPR_NUMBER;
-			e->number = type_getsize(parse_type());
+			e->number = type_getsize(parse_type(ctx));
 			e->type = type_fromint(e->number);
 			break;
 		default:
-			e = parse_postfix_expr(st);
+			e = parse_postfix_expr(ctx, st);
 			break;
 	}
 	return e;
@@ -215,18 +369,18 @@ struct expr* parse_unary_expr(struct symtable* st) {
 // cast_expr
 //	: unary_expr
 //	| '(' type ')' cast_expr
-struct expr* parse_cast_expr(struct symtable* st) {
+struct expr* parse_cast_expr(struct tc_context* ctx, struct symtable* st) {
 	struct expr* e;
-	if (peek()->token == '(' && lookahead(1)->token == T_TYPE) {
-		expect('(');
-		e = malloc(sizeof(struct expr));
+	if (peek(ctx) == '(' && lookahead(ctx, 1) == T_TYPE) {
+		expect(ctx, '(');
+		e = node_alloc(ctx, sizeof(struct expr));
 		e->expr_type = EXPR_CAST;
-		e->type = parse_type();
-		expect(')');
-		e->unop = parse_cast_expr(st);
-		e->unop->parent = e;
+		e->type = parse_type(ctx);
+		expect(ctx, ')');
+		e->unop = expr_value(parse_cast_expr(ctx, st));
+		e = expr_fold(e);
 	} else {
-		e = parse_unary_expr(st);
+		e = parse_unary_expr(ctx, st);
 	}
 	return e;
 }
@@ -235,20 +389,19 @@ struct expr* parse_cast_expr(struct symtable* st) {
 //	: cast_expr
 //	| mul_expr '*' cast_expr
 //	| mul_expr '/' cast_expr
-struct expr* parse_mul_expr(struct symtable* st) {
-	struct expr* e = parse_cast_expr(st);
-	while (peek()->token == '*' ||
-			peek()->token == '/') {
-		struct token* t = next();
+struct expr* parse_mul_expr(struct tc_context* ctx, struct symtable* st) {
+	struct expr* e = parse_cast_expr(ctx, st);
+	while (peek(ctx) == '*' ||
+			peek(ctx) == '/') {
+		int t = next(ctx);
 		struct expr* left = e;
-		e = malloc(sizeof(struct expr));
-		if (t->token == '*') e->expr_type = EXPR_MUL;
-		else if (t->token == '/') e->expr_type = EXPR_DIV;
-		e->binop.left = left;
-		e->binop.left->parent = e;
-		e->binop.right = parse_cast_expr(st);
-		e->binop.right->parent = e;
+		e = node_alloc(ctx, sizeof(struct expr));
+		if (t == '*') e->expr_type = EXPR_MUL;
+		else if (t == '/') e->expr_type = EXPR_DIV;
+		e->binop.left = expr_value(left);
+		e->binop.right = expr_value(parse_cast_expr(ctx, st));
 		e->type = type_bigger(e->binop.left->type, e->binop.right->type);
+		e = expr_fold(e);
 	}
 	return e;
 }
@@ -257,36 +410,33 @@ struct expr* parse_mul_expr(struct symtable* st) {
 //	: mul_expr
 //	| add_expr '+' mul_expr
 //	| add_expr '-' mul_expr
-struct expr* parse_add_expr(struct symtable* st) {
-	struct expr* e = parse_mul_expr(st);
-	while (peek()->token == '+' ||
-			peek()->token == '-') {
-		struct token* t = next();
+struct expr* parse_add_expr(struct tc_context* ctx, struct symtable* st) {
+	struct expr* e = parse_mul_expr(ctx, st);
+	while (peek(ctx) == '+' ||
+			peek(ctx) == '-') {
+		int t = next(ctx);
 		struct expr* left = e;
-		e = malloc(sizeof(struct expr));
-		if (t->token == '+') e->expr_type = EXPR_ADD;
-		else if (t->token == '-') e->expr_type = EXPR_SUB;
-		e->binop.left = left;
-		e->binop.left->parent = e;
-		e->binop.right = parse_mul_expr(st);
-		e->binop.right->parent = e;
+		e = node_alloc(ctx, sizeof(struct expr));
+		if (t == '+') e->expr_type = EXPR_ADD;
+		else if (t == '-') e->expr_type = EXPR_SUB;
+		e->binop.left = expr_value(left);
+		e->binop.right = expr_value(parse_mul_expr(ctx, st));
 		if (type_getpointer(e->binop.left->type)) {
 			if (type_getpointer(e->binop.right->type))
-				error(prev(), "can't add two pointers.\n");
+				error(ctx, prev(ctx), "can't add two pointers.\n");
 			e->type = e->binop.left->type;
-			e->binop.right = expr_scale(e->binop.right,
+			e->binop.right = expr_scale(ctx, e->binop.right,
 					type_getsize(type_fromptr(e->type)));
-			e->binop.right->parent = e;
 		} else if (type_getpointer(e->binop.right->type)) {
 			if (type_getpointer(e->binop.left->type))
-				error(prev(), "can't add two pointers.\n");
+				error(ctx, prev(ctx), "can't add two pointers.\n");
 			e->type = e->binop.right->type;
-			e->binop.left = expr_scale(e->binop.left,
+			e->binop.left = expr_scale(ctx, e->binop.left,
 					type_getsize(type_fromptr(e->type)));
-			e->binop.left->parent = e;
 		} else {
 			e->type = type_bigger(e->binop.left->type, e->binop.right->type);
 		}
+		e = expr_fold(e);
 	}
 	return e;
 }
@@ -295,20 +445,19 @@ struct expr* parse_add_expr(struct symtable* st) {
 //	: add_expr
 //	| shift_expr '<<' add_expr
 //	| shift_expr '>>' add_expr
-struct expr* parse_shift_expr(struct symtable* st) {
-	struct expr* e = parse_add_expr(st);
-	while (peek()->token == T_SHL ||
-			peek()->token == T_SHR) {
-		struct token* t = next();
+struct expr* parse_shift_expr(struct tc_context* ctx, struct symtable* st) {
+	struct expr* e = parse_add_expr(ctx, st);
+	while (peek(ctx) == T_SHL ||
+			peek(ctx) == T_SHR) {
+		int t = next(ctx);
 		struct expr* left = e;
-		e = malloc(sizeof(struct expr));
-		if (t->token == T_SHL) e->expr_type = EXPR_SHL;
-		else if (t->token == T_SHR) e->expr_type = EXPR_SHR;
-		e->binop.left = left;
-		e->binop.left->parent = e;
-		e->binop.right = parse_add_expr(st);
-		e->binop.right->parent = e;
+		e = node_alloc(ctx, sizeof(struct expr));
+		if (t == T_SHL) e->expr_type = EXPR_SHL;
+		else if (t == T_SHR) e->expr_type = EXPR_SHR;
+		e->binop.left = expr_value(left);
+		e->binop.right = expr_value(parse_add_expr(ctx, st));
 		e->type = e->binop.left->type;
+		e = expr_fold(e);
 	}
 	return e;
 }
@@ -319,24 +468,23 @@ struct expr* parse_shift_expr(struct symtable* st) {
 //	| rel_expr '>' shift_expr
 //	| rel_expr '<=' shift_expr
 //	| rel_expr '>=' shift_expr
-struct expr* parse_rel_expr(struct symtable* st) {
-	struct expr* e = parse_shift_expr(st);
-	while (peek()->token == '<' ||
-		   peek()->token == '>' ||
-		   peek()->token == T_LE ||
-		   peek()->token == T_GE) {
-		struct token* t = next();
+struct expr* parse_rel_expr(struct tc_context* ctx, struct symtable* st) {
+	struct expr* e = parse_shift_expr(ctx, st);
+	while (peek(ctx) == '<' ||
+		   peek(ctx) == '>' ||
+		   peek(ctx) == T_LE ||
+		   peek(ctx) == T_GE) {
+		int t = next(ctx);
 		struct expr* left = e;
-		e = malloc(sizeof(struct expr));
-		if (t->token == '<') e->expr_type = EXPR_LT;
-		else if (t->token == '>') e->expr_type = EXPR_GT;
-		else if (t->token == T_LE) e->expr_type = EXPR_LTE;
-		else if (t->token == T_GE) e->expr_type = EXPR_GTE;
-		e->binop.left = left;
-		e->binop.left->parent = e;
-		e->binop.right = parse_shift_expr(st);
-		e->binop.right->parent = e;
+		e = node_alloc(ctx, sizeof(struct expr));
+		if (t == '<') e->expr_type = EXPR_LT;
+		else if (t == '>') e->expr_type = EXPR_GT;
+		else if (t == T_LE) e->expr_type = EXPR_LTE;
+		else if (t == T_GE) e->expr_type = EXPR_GTE;
+		e->binop.left = expr_value(left);
+		e->binop.right = expr_value(parse_shift_expr(ctx, st));
 		e->type = TYPE_8 | TYPE_SIGNED;
+		e = expr_fold(e);
 	}
 	return e;
 }
@@ -345,20 +493,19 @@ struct expr* parse_rel_expr(struct symtable* st) {
 //	: rel_expr
 //	| eq_expr '==' rel_expr
 //	| eq_expr '!=' rel_expr
-struct expr* parse_eq_expr(struct symtable* st) {
-	struct expr* e = parse_rel_expr(st);
-	while (peek()->token == T_EQ ||
-			peek()->token == T_NE) {
-		struct token* t = next();
+struct expr* parse_eq_expr(struct tc_context* ctx, struct symtable* st) {
+	struct expr* e = parse_rel_expr(ctx, st);
+	while (peek(ctx) == T_EQ ||
+			peek(ctx) == T_NE) {
+		int t = next(ctx);
 		struct expr* left = e;
-		e = malloc(sizeof(struct expr));
-		if (t->token == T_EQ) e->expr_type = EXPR_EQ;
-		else if (t->token == T_NE) e->expr_type = EXPR_NEQ;
-		e->binop.left = left;
-		e->binop.left->parent = e;
-		e->binop.right = parse_rel_expr(st);
-		e->binop.right->parent = e;
+		e = node_alloc(ctx, sizeof(struct expr));
+		if (t == T_EQ) e->expr_type = EXPR_EQ;
+		else if (t == T_NE) e->expr_type = EXPR_NEQ;
+		e->binop.left = expr_value(left);
+		e->binop.right = expr_value(parse_rel_expr(ctx, st));
 		e->type = TYPE_8 | TYPE_SIGNED;
+		e = expr_fold(e);
 	}
 	return e;
 }
@@ -366,17 +513,16 @@ struct expr* parse_eq_expr(struct symtable* st) {
 // and_expr
 //	: eq_expr
 //	| and_expr '&' eq_expr
-struct expr* parse_and_expr(struct symtable* st) {
-	struct expr* e = parse_eq_expr(st);
-	while (optional('&')) {
+struct expr* parse_and_expr(struct tc_context* ctx, struct symtable* st) {
+	struct expr* e = parse_eq_expr(ctx, st);
+	while (optional(ctx, '&')) {
 		struct expr* left = e;
-		e = malloc(sizeof(struct expr));
+		e = node_alloc(ctx, sizeof(struct expr));
 		e->expr_type = EXPR_AND;
-		e->binop.left = left;
-		e->binop.left->parent = e;
-		e->binop.right = parse_eq_expr(st);
-		e->binop.right->parent = e;
+		e->binop.left = expr_value(left);
+		e->binop.right = expr_value(parse_eq_expr(ctx, st));
 		e->type = e->binop.left->type;
+		e = expr_fold(e);
 	}
 	return e;
 }
@@ -384,17 +530,16 @@ struct expr* parse_and_expr(struct symtable* st) {
 // or_expr
 //	: and_expr
 //	| or_expr '|' and_expr
-struct expr* parse_or_expr(struct symtable* st) {
-	struct expr* e = parse_and_expr(st);
-	while (optional('|')) {
+struct expr* parse_or_expr(struct tc_context* ctx, struct symtable* st) {
+	struct expr* e = parse_and_expr(ctx, st);
+	while (optional(ctx, '|')) {
 		struct expr* left = e;
-		e = malloc(sizeof(struct expr));
+		e = node_alloc(ctx, sizeof(struct expr));
 		e->expr_type = EXPR_OR;
-		e->binop.left = left;
-		e->binop.left->parent = e;
-		e->binop.right = parse_and_expr(st);
-		e->binop.right->parent = e;
+		e->binop.left = expr_value(left);
+		e->binop.right = expr_value(parse_and_expr(ctx, st));
 		e->type = e->binop.left->type;
+		e = expr_fold(e);
 	}
 	return e;
 }
@@ -402,19 +547,17 @@ struct expr* parse_or_expr(struct symtable* st) {
 // assign_expr
 //	: or_expr
 //	| unary_expr '=' assign_expr
-struct expr* parse_assign_expr(struct symtable* st) {
-	struct expr* e = parse_or_expr(st);
+struct expr* parse_assign_expr(struct tc_context* ctx, struct symtable* st) {
+	struct expr* e = parse_or_expr(ctx, st);
 	if (e->expr_type == EXPR_NAME || e->expr_type == EXPR_DEREF) {
-		if (optional('=')) {
+		if (optional(ctx, '=')) {
 			struct expr* left = e;
-			e = malloc(sizeof(struct expr));
+			e = node_alloc(ctx, sizeof(struct expr));
 			e->expr_type = EXPR_ASSIGN;
 			e->binop.left = left;
-			e->binop.left->parent = e;
-			e->binop.right = parse_assign_expr(st);
-			e->binop.right->parent = e;
+			e->binop.right = expr_value(parse_assign_expr(ctx, st));
 			if (!type_fits(e->binop.right->type, e->binop.left->type))
-				type_error(prev(), e->binop.left->type, e->binop.right->type);
+				type_error(ctx, prev(ctx), e->binop.left->type, e->binop.right->type);
 		}
 	}
 	return e;
@@ -422,35 +565,35 @@ struct expr* parse_assign_expr(struct symtable* st) {
 
 // expr
 //	: assign_expr
-struct expr* parse_expr(struct symtable* st) {
-	return parse_assign_expr(st);
+struct expr* parse_expr(struct tc_context* ctx, struct symtable* st) {
+	return expr_value(parse_assign_expr(ctx, st));
 }
 
 // compound_stmt
 //	: '{' stmt* '}'
-struct stmt* parse_compound_stmt(struct symtable* st) {
-	struct stmt* s = malloc(sizeof(struct stmt));
-	expect('{');
+struct stmt* parse_compound_stmt(struct tc_context* ctx, struct symtable* st) {
+	struct stmt* s = node_alloc(ctx, sizeof(struct stmt));
+	expect(ctx, '{');
 	s->stmt_type = STMT_COMPOUND;
-	s->compound.st = symtable_alloc(st);
-	s->compound.stmts = vec_alloc();
-	while (peek()->token != '}') {
-		vec_push(s->compound.stmts, parse_stmt(s->compound.st));
+	s->compound.st = symtable_alloc(ctx->arena, st);
+	s->compound.stmts = vec_alloc(ctx->arena);
+	while (peek(ctx) != '}' && peek(ctx) != T_EOF) {
+		vec_push(s->compound.stmts, parse_stmt(ctx, s->compound.st));
 	}
-	expect('}');
+	expect(ctx, '}');
 	return s;
 }
 
 // sel_stmt
 //	: 'if' expr stmt ('else' stmt)?
-struct stmt* parse_sel_stmt(struct symtable* st) {
-	struct stmt* s = malloc(sizeof(struct stmt));
-	switch (next()->token) {
+struct stmt* parse_sel_stmt(struct tc_context* ctx, struct symtable* st) {
+	struct stmt* s = node_alloc(ctx, sizeof(struct stmt));
+	switch (next(ctx)) {
 		case T_IF:
 			s->stmt_type = STMT_IF;
-			s->_if.cond = parse_expr(st);
-			s->_if._true = parse_stmt(st);
-			s->_if._false = optional(T_ELSE) ? parse_stmt(st) : NULL;
+			s->_if.cond = parse_expr(ctx, st);
+			s->_if._true = parse_stmt(ctx, st);
+			s->_if._false = optional(ctx, T_ELSE) ? parse_stmt(ctx, st) : NULL;
 			break;
 		default:
 			break;
@@ -460,13 +603,13 @@ struct stmt* parse_sel_stmt(struct symtable* st) {
 
 // iter_stmt
 //	: 'while' expr stmt
-struct stmt* parse_iter_stmt(struct symtable* st) {
-	struct stmt* s = malloc(sizeof(struct stmt));
-	switch (next()->token) {
+struct stmt* parse_iter_stmt(struct tc_context* ctx, struct symtable* st) {
+	struct stmt* s = node_alloc(ctx, sizeof(struct stmt));
+	switch (next(ctx)) {
 		case T_WHILE:
 			s->stmt_type = STMT_WHILE;
-			s->_while.cond = parse_expr(st);
-			s->_while.stmt = parse_stmt(st);
+			s->_while.cond = parse_expr(ctx, st);
+			s->_while.stmt = parse_stmt(ctx, st);
 			break;
 		default:
 			break;
@@ -476,14 +619,14 @@ struct stmt* parse_iter_stmt(struct symtable* st) {
 
 // jump_stmt
 //	: 'return' expr? ';'
-struct stmt* parse_jump_stmt(struct symtable* st) {
-	struct stmt* s = malloc(sizeof(struct stmt));
-	switch (next()->token) {
+struct stmt* parse_jump_stmt(struct tc_context* ctx, struct symtable* st) {
+	struct stmt* s = node_alloc(ctx, sizeof(struct stmt));
+	switch (next(ctx)) {
 		case T_RETURN:
 			s->stmt_type = STMT_RETURN;
-			if (!optional(';')) {
-				s->expr = parse_expr(st);
-				expect(';');
+			if (!optional(ctx, ';')) {
+				s->expr = parse_expr(ctx, st);
+				expect(ctx, ';');
 			} else {
 				s->expr = NULL;
 			}
@@ -496,45 +639,48 @@ struct stmt* parse_jump_stmt(struct symtable* st) {
 
 // decl_stmt
 //	: 'var' NAME ':' type ('=' assign_expr)? ';'
-struct stmt* parse_decl_stmt(struct symtable* st) {
-	struct sym* sym = sym_alloc(symtable_get_root(st) == st ? SYM_GLOBAL : SYM_LOCAL);
-	expect(T_VAR);
-	sym->name = expect(T_NAME)->name;
-	expect(':');
-	sym->type = parse_type();
-	sym->offset = sym->sym_type == SYM_LOCAL ?
-		sym_get_last_offset(st) - type_getalign(sym->type) : 0;
-
-	struct stmt* s = malloc(sizeof(struct stmt));
-	if (sym->sym_type == SYM_LOCAL && optional('=')) {
+struct stmt* parse_decl_stmt(struct tc_context* ctx, struct symtable* st) {
+	struct sym* sym = symbol_alloc(ctx, st->arena,
+			symtable_get_root(st) == st ? SYM_GLOBAL : SYM_LOCAL);
+	expect(ctx, T_VAR);
+	sym->ident = expect(ctx, T_NAME).ident;
+	sym->name = sym->ident->name;
+	expect(ctx, ':');
+	sym->type = parse_type(ctx);
+
+	struct stmt* s = node_alloc(ctx, sizeof(struct stmt));
+	if (sym->sym_type == SYM_LOCAL && optional(ctx, '=')) {
 		s->stmt_type = STMT_EXPR;
-		s->expr = malloc(sizeof(struct expr));
+		s->expr = node_alloc(ctx, sizeof(struct expr));
 		s->expr->expr_type = EXPR_ASSIGN;
-		s->expr->binop.left = malloc(sizeof(struct expr));
+		s->expr->binop.left = node_alloc(ctx, sizeof(struct expr));
 		s->expr->binop.left->expr_type = EXPR_NAME;
 		s->expr->binop.left->type = sym->type;
-		s->expr->binop.left->name = sym->name;
-		s->expr->binop.right = parse_assign_expr(st);
+		s->expr->binop.left->sym = sym;
+		s->expr->binop.right = expr_value(parse_assign_expr(ctx, st));
 	} else {
 		s->stmt_type = STMT_NOOP;
 	}
-	expect(';');
+	expect(ctx, ';');
 
-	sym_put(st, sym);
+	if (sym->sym_type == SYM_LOCAL)
+		sym_put_local(st, sym);
+	else
+		sym_put(st, sym);
 	return s;
 }
 
 // expr_stmt
 //	| ';'
 //	| expr ';'
-struct stmt* parse_expr_stmt(struct symtable* st) {
-	struct stmt* s = malloc(sizeof(struct stmt));
-	if (optional(';')) {
+struct stmt* parse_expr_stmt(struct tc_context* ctx, struct symtable* st) {
+	struct stmt* s = node_alloc(ctx, sizeof(struct stmt));
+	if (optional(ctx, ';')) {
 		s->stmt_type = STMT_NOOP;
 	} else {
 		s->stmt_type = STMT_EXPR;
-		s->expr = parse_expr(st);
-		expect(';');
+		s->expr = parse_expr(ctx, st);
+		expect(ctx, ';');
 	}
 	return s;
 }
@@ -546,90 +692,452 @@ struct stmt* parse_expr_stmt(struct symtable* st) {
 //	| jump_stmt
 //	| decl_stmt
 //	| expr_stmt
-struct stmt* parse_stmt(struct symtable* st) {
-	switch (peek()->token) {
-		case '{': return parse_compound_stmt(st);
-		case T_IF: return parse_sel_stmt(st);
-		case T_WHILE: return parse_iter_stmt(st);
-		case T_RETURN: return parse_jump_stmt(st);
-		case T_VAR: return parse_decl_stmt(st);
-		default: return parse_expr_stmt(st);
+struct stmt* parse_stmt(struct tc_context* ctx, struct symtable* st) {
+	switch (peek(ctx)) {
+		case '{': return parse_compound_stmt(ctx, st);
+		case T_IF: return parse_sel_stmt(ctx, st);
+		case T_WHILE: return parse_iter_stmt(ctx, st);
+		case T_RETURN: return parse_jump_stmt(ctx, st);
+		case T_VAR: return parse_decl_stmt(ctx, st);
+		default: return parse_expr_stmt(ctx, st);
 	}
 }
 
 // ext_func
 //	: 'extern' 'fn' NAME '(' type? (',' type)* ')' (':' type) ';'
-void parse_ext_func(struct symtable* st) {
-	struct sym* fs = sym_alloc(SYM_FUNC);
-	expect(T_EXTERN);
-	expect(T_FN);
-	fs->name = expect(T_NAME)->name;
-	expect('(');
-	while (peek()->token != ')') {
-		sym_add_param(fs, parse_type());
-		optional(',');
-	}
-	expect(')');
-	fs->type = optional(':') ? parse_type() : TYPE_0;
-	expect(';');
+void parse_ext_func(struct tc_context* ctx, struct symtable* st) {
+	struct sym* fs = symbol_alloc(ctx, st->arena, SYM_FUNC);
+	expect(ctx, T_EXTERN);
+	expect(ctx, T_FN);
+	fs->ident = expect(ctx, T_NAME).ident;
+	fs->name = fs->ident->name;
+	expect(ctx, '(');
+	while (peek(ctx) != ')') {
+		sym_add_param(st->arena, fs, parse_type(ctx));
+		optional(ctx, ',');
+	}
+	expect(ctx, ')');
+	fs->type = optional(ctx, ':') ? parse_type(ctx) : TYPE_0;
+	expect(ctx, ';');
 	sym_put(st, fs);
 }
 
-// func
-//	: 'fn' NAME '(' (NAME ':' type)? (',' NAME ':' type)* ')' (':' type)? stmt
-struct func* parse_func(struct symtable* st) {
-	struct func* f = malloc(sizeof(struct func));
-	struct sym* fs = sym_alloc(SYM_FUNC);
-
-	expect(T_FN);
-	f->name = expect(T_NAME)->name;
-	fs->name = f->name;
-
-	f->st = symtable_alloc(st);
-	expect('(');
-	while (peek()->token != ')') {
-		struct sym* s = sym_alloc(SYM_LOCAL);
-		s->name = expect(T_NAME)->name;
-		expect(':');
-		s->type = parse_type();
-		s->offset = sym_get_last_offset(f->st) - type_getalign(s->type);
-		sym_put(f->st, s);
-		sym_add_param(fs, s->type);
-		optional(',');
-	}
-	expect(')');
-
-	f->type = optional(':') ? parse_type() : TYPE_0;
-	fs->type = f->type;
-	sym_put(st, fs);
+// func_sig
+//	: 'fn' NAME '(' (NAME ':' type)? (',' NAME ':' type)* ')' (':' type)?
+// parses a signature into a function with its parameters in scope, and
+// declares it in 'st' unless that was already done by an earlier pass
+static struct func* parse_func_sig(struct tc_context* ctx, struct symtable* st, bool declare) {
+	struct func* f = arena_push(ctx->arena, sizeof(struct func));
+	struct sym* fs = declare ? symbol_alloc(ctx, st->arena, SYM_FUNC) : NULL;
 
-	f->stmt = parse_stmt(f->st);
+	expect(ctx, T_FN);
+	struct ident* ident = expect(ctx, T_NAME).ident;
+	f->name = ident->name;
+
+	f->st = symtable_alloc_frame(ctx->arena, st);
+	expect(ctx, '(');
+	while (peek(ctx) != ')') {
+		// a signature parsed again has already been counted
+		struct sym* s = declare ? symbol_alloc(ctx, f->st->arena, SYM_LOCAL) :
+			sym_alloc(f->st->arena, SYM_LOCAL);
+		s->ident = expect(ctx, T_NAME).ident;
+		s->name = s->ident->name;
+		expect(ctx, ':');
+		s->type = parse_type(ctx);
+		sym_put_local(f->st, s);
+		if (declare)
+			sym_add_param(st->arena, fs, s->type);
+		optional(ctx, ',');
+	}
+	expect(ctx, ')');
+
+	f->type = optional(ctx, ':') ? parse_type(ctx) : TYPE_0;
+	if (declare) {
+		fs->ident = ident;
+		fs->name = ident->name;
+		fs->type = f->type;
+		sym_put(st, fs);
+	}
+	return f;
+}
+
+// func
+//	: func_sig stmt
+struct func* parse_func(struct tc_context* ctx, struct symtable* st) {
+	struct func* f = parse_func_sig(ctx, st, true);
+	f->stmt = parse_stmt(ctx, f->st);
 	return f;
 }
 
 // lib
 //	: (ext_func | decl_stmt | func)*
-struct lib* parse(struct vec* _tokens) {
-	tokens = _tokens;
-
-	struct lib* l = malloc(sizeof(struct lib));
-	l->st = symtable_alloc(NULL);
-	l->funcs = vec_alloc();
-	while (peek()->token != T_EOF) {
-		switch (peek()->token) {
+// without 'emit' every function is kept in 'funcs', otherwise each one is
+// handed over as soon as it is parsed. trees go in 'func_arena', which is
+// reset after every function, or stay in 'a' if there is none
+static struct lib* parse_lib(struct tc_context* ctx, struct arena* a, struct arena* func_arena,
+		void (*emit)(struct tc_context*, struct func*)) {
+	struct lib* l = arena_push(a, sizeof(struct lib));
+	l->st = symtable_alloc(a, NULL);
+	l->funcs = vec_alloc(a);
+	while (peek(ctx) != T_EOF) {
+		switch (peek(ctx)) {
 			case T_EXTERN:
-				parse_ext_func(l->st);
+				parse_ext_func(ctx, l->st);
 				break;
 			case T_VAR:
-				parse_decl_stmt(l->st);
+				parse_decl_stmt(ctx, l->st);
 				break;
-			case T_FN:
-				vec_push(l->funcs, parse_func(l->st));
+			case T_FN: {
+				struct trace_time start;
+				trace_begin(ctx, &start);
+				if (func_arena != NULL && emit != NULL)
+					ctx->arena = func_arena;
+				struct func* f = parse_func(ctx, l->st);
+				trace_end(ctx, &start, "parse", f->name);
+				if (emit == NULL) {
+					vec_push(l->funcs, f);
+				} else if (func_arena == NULL) {
+					emit(ctx, f);
+				} else {
+					emit(ctx, f);
+					arena_reset(func_arena);
+					ctx->arena = a;
+				}
 				break;
+			}
 			default:
-				token_error(peek(), 0);
+				token_error(ctx, ctx->current_token, 0);
 				break;
 		}
 	}
 	return l;
+}
+
+// parses 'tokens' into a lib, keeping the tree and symbols in 'a'
+struct lib* parse(struct tc_context* ctx, struct tokens* tokens, struct arena* a) {
+	ctx->tokens = tokens;
+	ctx->current_token = ctx->current_value = 0;
+	ctx->root_visible = INT_MAX;
+	ctx->strings = ctx->calls = NULL;
+	ctx->arena = a;
+	return parse_lib(ctx, a, NULL, NULL);
+}
+
+// parses 'tokens' one function at a time, passing each to 'emit' before
+// moving on to the next. only the root scope, which holds the functions,
+// globals and strings, is kept in 'a'; each function's tree goes in
+// 'func_arena', which is reset after it has been emitted, so memory doesn't
+// grow with the number of functions. if 'func_arena' is NULL the trees are
+// kept in 'a' instead, for an 'emit' that holds on to them. the returned lib
+// has no 'funcs'
+struct lib* parse_stream(struct tc_context* ctx, struct tokens* tokens, struct arena* a,
+		struct arena* func_arena, void (*emit)(struct tc_context*, struct func*)) {
+	ctx->tokens = tokens;
+	ctx->current_token = ctx->current_value = 0;
+	ctx->root_visible = INT_MAX;
+	ctx->strings = ctx->calls = NULL;
+	ctx->arena = a;
+	return parse_lib(ctx, a, func_arena, emit);
+}
+
+/*
+ * Parallel
+ */
+// A function whose body is parsed on a worker. 'visible' is how many root
+// symbols had been declared by the end of its signature, so the body sees
+// only those, as it would parsing front to back. 'calls' are the functions
+// the body calls
+struct parse_job {
+	int token, value;
+	int visible;
+	int end;
+	bool reached;
+	struct func* func;
+	struct vec* strings;
+	struct vec* calls;
+	char* error;
 };
+
+struct parse_pool {
+	struct tc_context* ctx;
+	struct symtable* root;
+	struct parse_job* jobs;
+	// the jobs to parse this time, in source order
+	int* todo;
+	int todo_count;
+	atomic_int next;
+	atomic_int arena_next;
+	// earliest job that failed, later ones needn't be parsed
+	atomic_int failed;
+	// what the workers made, for the time report
+	atomic_long node_count;
+	atomic_long sym_count;
+};
+
+static void* parse_worker(void* p) {
+	struct parse_pool* pool = p;
+	struct tc_context local;
+	struct tc_context* ctx = &local;
+	memcpy(ctx, pool->ctx, sizeof(struct tc_context));
+	ctx->arena = ctx->worker_arenas[atomic_fetch_add(&pool->arena_next, 1)];
+	ctx->node_count = ctx->sym_count = 0;
+
+	for (int n; (n = atomic_fetch_add(&pool->next, 1)) < pool->todo_count;) {
+		int i = pool->todo[n];
+		struct parse_job* job = &pool->jobs[i];
+		if (job->func != NULL || i > atomic_load(&pool->failed))
+			continue;
+		ctx->current_token = job->token;
+		ctx->current_value = job->value;
+		ctx->root_visible = job->visible;
+		ctx->strings = job->strings = vec_alloc(ctx->arena);
+		ctx->calls = job->calls = vec_alloc(ctx->arena);
+		if (setjmp(ctx->on_error)) {
+			job->error = strdup(ctx->error);
+			int failed = atomic_load(&pool->failed);
+			while (i < failed && !atomic_compare_exchange_weak(&pool->failed, &failed, i))
+				;
+			continue;
+		}
+		struct trace_time start;
+		trace_begin(ctx, &start);
+		struct func* f = parse_func_sig(ctx, pool->root, false);
+		f->stmt = parse_stmt(ctx, f->st);
+		job->func = f;
+		trace_end(ctx, &start, "parse", f->name);
+	}
+	atomic_fetch_add(&pool->node_count, ctx->node_count);
+	atomic_fetch_add(&pool->sym_count, ctx->sym_count);
+	return NULL;
+}
+
+// parses the bodies of the jobs in 'todo' on the workers and reports the
+// first error in source order, if any
+static void parse_run(struct tc_context* ctx, struct parse_pool* pool, int threads) {
+	atomic_store(&pool->next, 0);
+	atomic_store(&pool->arena_next, 0);
+	trace_cpu(ctx, pool_run(threads < pool->todo_count ? threads : pool->todo_count,
+			parse_worker, pool));
+	ctx->node_count += atomic_exchange(&pool->node_count, 0);
+	ctx->sym_count += atomic_exchange(&pool->sym_count, 0);
+	int first = atomic_load(&pool->failed);
+	if (first == INT_MAX)
+		return;
+	snprintf(ctx->error, sizeof(ctx->error), "%s", pool->jobs[first].error);
+	for (int i = 0; i < pool->todo_count; i++)
+		free(pool->jobs[pool->todo[i]].error);
+	longjmp(ctx->on_error, 1);
+}
+
+// skips the statement starting with '{' by matching braces, leaving the
+// parsing to a worker. returns false, back at the '{', if the file ends
+// before it's closed
+static bool skip_body(struct tc_context* ctx) {
+	int token = ctx->current_token, value = ctx->current_value;
+	int depth = 0;
+	do {
+		int kind = peek(ctx);
+		if (kind == T_EOF) {
+			ctx->current_token = token;
+			ctx->current_value = value;
+			return false;
+		}
+		next(ctx);
+		if (kind == '{')
+			depth++;
+		else if (kind == '}')
+			depth--;
+	} while (depth > 0);
+	return true;
+}
+
+// parses the root scope and the function signatures into 'l', leaving a
+// job for each function body. returns false if it stopped at an error,
+// which is left in the context
+static bool parse_sigs(struct tc_context* ctx, struct lib* l, struct vec* jobs) {
+	// an error here only stops the pass: one in a body before it has to be
+	// reported first
+	jmp_buf on_error;
+	memcpy(on_error, ctx->on_error, sizeof(jmp_buf));
+	bool ok = true;
+	if (setjmp(ctx->on_error)) {
+		ok = false;
+	} else {
+		while (peek(ctx) != T_EOF) {
+			switch (peek(ctx)) {
+				case T_EXTERN:
+					parse_ext_func(ctx, l->st);
+					break;
+				case T_VAR:
+					parse_decl_stmt(ctx, l->st);
+					break;
+				case T_FN: {
+					struct parse_job* job = arena_push(ctx->arena, sizeof(struct parse_job));
+					job->token = ctx->current_token;
+					job->value = ctx->current_value;
+					job->reached = false;
+					job->strings = job->calls = NULL;
+					job->error = NULL;
+					struct func* f = parse_func_sig(ctx, l->st, true);
+					job->visible = l->st->syms->size;
+					// a body left open is parsed here, to fail where the
+					// parser would even if nothing reaches it
+					if (peek(ctx) == '{' && skip_body(ctx)) {
+						job->func = NULL;
+					} else {
+						ctx->strings = job->strings = vec_alloc(ctx->arena);
+						ctx->calls = job->calls = vec_alloc(ctx->arena);
+						f->stmt = parse_stmt(ctx, f->st);
+						ctx->strings = ctx->calls = NULL;
+						job->func = f;
+					}
+					job->end = tokens_offset(ctx->tokens, prev(ctx));
+					vec_push(jobs, job);
+					break;
+				}
+				default:
+					token_error(ctx, ctx->current_token, 0);
+					break;
+			}
+		}
+	}
+	memcpy(ctx->on_error, on_error, sizeof(jmp_buf));
+	return ok;
+}
+
+// marks job 'i' to be parsed next, once
+static void parse_reach(struct parse_pool* pool, int i, int* todo, int* count) {
+	if (pool->jobs[i].reached)
+		return;
+	pool->jobs[i].reached = true;
+	todo[(*count)++] = i;
+}
+
+static int compare_int(const void* a, const void* b) {
+	return *(const int*) a - *(const int*) b;
+}
+
+// parses 'tokens', which must hold the whole input, in two passes. the root
+// scope and the signatures are parsed first, on this thread, so every body
+// can then be parsed on its own against them, on up to 'threads' threads.
+// each function is passed to 'emit' in source order, or kept in the
+// returned lib's 'funcs' if 'emit' is NULL.
+//
+// with 'roots' NULL every body is parsed. otherwise only those of 'main',
+// of the functions named in 'roots', a NULL terminated list, and of the
+// functions they call, are, and only those functions are emitted
+static struct lib* parse_split(struct tc_context* ctx, struct tokens* tokens, struct arena* a,
+		int threads, const char** roots, void (*emit)(struct tc_context*, struct func*)) {
+	ctx->tokens = tokens;
+	ctx->current_token = ctx->current_value = 0;
+	ctx->root_visible = INT_MAX;
+	ctx->strings = ctx->calls = NULL;
+	ctx->arena = a;
+
+	struct lib* l = arena_push(a, sizeof(struct lib));
+	l->st = symtable_alloc(a, NULL);
+	l->funcs = vec_alloc(a);
+	struct vec* jobs = vec_alloc(a);
+	bool ok = parse_sigs(ctx, l, jobs);
+	char error[sizeof(ctx->error)];
+	memcpy(error, ctx->error, sizeof(error));
+
+	ctx->worker_arenas = malloc(threads * sizeof(struct arena*));
+	for (; ctx->worker_arena_count < threads; ctx->worker_arena_count++)
+		ctx->worker_arenas[ctx->worker_arena_count] = arena_alloc();
+	struct parse_pool pool = { ctx, l->st, arena_push(a, jobs->size * sizeof(struct parse_job)),
+		arena_push(a, jobs->size * sizeof(int)), 0, 0, 0, INT_MAX, 0, 0 };
+	for (int i = 0; i < jobs->size; i++)
+		pool.jobs[i] = *(struct parse_job*) jobs->data[i];
+
+	// the job of each function, by its position in the root scope
+	int* job_of = arena_push(a, l->st->syms->size * sizeof(int));
+	for (int i = 0; i < l->st->syms->size; i++)
+		job_of[i] = -1;
+	for (int i = 0; i < jobs->size; i++)
+		job_of[pool.jobs[i].visible - 1] = i;
+
+	// an error in the signatures needs every body before it parsed, to see
+	// whether one of them has an earlier error
+	int* next = arena_push(a, jobs->size * sizeof(int));
+	int next_count = 0;
+	for (int i = 0; i < l->st->syms->size; i++) {
+		struct sym* s = l->st->syms->data[i];
+		if (job_of[i] == -1)
+			continue;
+		bool root = roots == NULL || !ok || !strcmp(s->name, "main");
+		for (const char** r = roots; !root && *r != NULL; r++)
+			root = !strcmp(s->name, *r);
+		if (root)
+			parse_reach(&pool, job_of[i], next, &next_count);
+	}
+
+	// walks the call graph a level at a time, each level parsed in parallel
+	while (next_count > 0) {
+		int* todo = pool.todo;
+		pool.todo = next;
+		pool.todo_count = next_count;
+		qsort(pool.todo, pool.todo_count, sizeof(int), compare_int);
+		parse_run(ctx, &pool, threads);
+		next = todo;
+		next_count = 0;
+		for (int i = 0; i < pool.todo_count; i++) {
+			struct vec* calls = pool.jobs[pool.todo[i]].calls;
+			for (int j = 0; j < calls->size; j++) {
+				struct sym* s = calls->data[j];
+				if (job_of[s->index] != -1)
+					parse_reach(&pool, job_of[s->index], next, &next_count);
+			}
+		}
+	}
+	if (!ok) {
+		memcpy(ctx->error, error, sizeof(error));
+		longjmp(ctx->on_error, 1);
+	}
+
+	// each function's strings go in the root scope right after it, and are
+	// numbered in that order
+	struct vec* syms = vec_alloc(a);
+	ctx->string_count = 0;
+	for (int i = 0; i < l->st->syms->size; i++) {
+		vec_push(syms, l->st->syms->data[i]);
+		struct parse_job* job = job_of[i] != -1 ? &pool.jobs[job_of[i]] : NULL;
+		if (job != NULL && job->reached) {
+			for (int k = 0; k < job->strings->size; k++)
+				vec_push(syms, job->strings->data[k]);
+		}
+	}
+	for (int i = 0; i < syms->size; i++) {
+		struct sym* s = syms->data[i];
+		s->index = i;
+		if (s->sym_type == SYM_STRING)
+			s->offset = ctx->string_count++;
+	}
+	l->st->syms = syms;
+
+	for (int i = 0; i < jobs->size; i++) {
+		if (!pool.jobs[i].reached)
+			continue;
+		lex_flush_asm(ctx, pool.jobs[i].end);
+		if (emit != NULL)
+			emit(ctx, pool.jobs[i].func);
+		else
+			vec_push(l->funcs, pool.jobs[i].func);
+	}
+	lex_flush_asm(ctx, INT_MAX);
+	return l;
+}
+
+// parses every function body, split across 'threads' threads
+struct lib* parse_parallel(struct tc_context* ctx, struct tokens* tokens, struct arena* a,
+		int threads, void (*emit)(struct tc_context*, struct func*)) {
+	return parse_split(ctx, tokens, a, threads, NULL, emit);
+}
+
+// parses only the bodies of the functions reachable from 'main' and from
+// 'roots', skipping the rest
+struct lib* parse_lazy(struct tc_context* ctx, struct tokens* tokens, struct arena* a,
+		int threads, const char** roots, void (*emit)(struct tc_context*, struct func*)) {
+	static const char* none[] = { NULL };
+	return parse_split(ctx, tokens, a, threads, roots != NULL ? roots : none, emit);
+}
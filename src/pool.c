@@ -0,0 +1,37 @@
+#include "pool.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+struct pool_thread {
+	pthread_t thread;
+	void* (*work)(void*);
+	void* arg;
+	double cpu;
+};
+
+static void* pool_thread(void* p) {
+	struct pool_thread* t = p;
+	t->work(t->arg);
+	struct timespec cpu;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+	t->cpu = cpu.tv_sec + cpu.tv_nsec / 1e9;
+	return NULL;
+}
+
+double pool_run(int threads, void* (*work)(void*), void* arg) {
+	struct pool_thread* workers = malloc(threads * sizeof(struct pool_thread));
+	for (int i = 1; i < threads; i++) {
+		workers[i] = (struct pool_thread) { .work = work, .arg = arg, .cpu = 0 };
+		pthread_create(&workers[i].thread, NULL, pool_thread, &workers[i]);
+	}
+	work(arg);
+	double cpu = 0;
+	for (int i = 1; i < threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		cpu += workers[i].cpu;
+	}
+	free(workers);
+	return cpu;
+}
@@ -0,0 +1,167 @@
+#include "scan.h"
+
+#include <stdbool.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86
+#endif
+
+/*
+ * Scalar
+ */
+static bool isws(unsigned char c) {
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static bool isword(unsigned char c) {
+	return (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'z') || c == '_';
+}
+
+static const char* scalar_space(const char* p, const char* end) {
+	while (p < end && isws(*p))
+		p++;
+	return p;
+}
+
+static const char* scalar_word(const char* p, const char* end) {
+	while (p < end && isword(*p))
+		p++;
+	return p;
+}
+
+static const char* scalar_comment(const char* p, const char* end) {
+	while (p < end && *p != '/' && *p != '*')
+		p++;
+	return p;
+}
+
+static const char* scalar_line(const char* p, const char* end) {
+	while (p < end && *p != '\n')
+		p++;
+	return p;
+}
+
+#ifdef SCAN_X86
+/*
+ * SSE2, 16 bytes at a time
+ */
+// each mask has a bit set for every byte that is part of the run being
+// skipped, so the run ends at the first zero bit
+static inline int sse2_space_mask(__m128i x) {
+	__m128i m = _mm_or_si128(
+		_mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(x, _mm_set1_epi8('\t'))),
+		_mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(x, _mm_set1_epi8('\r'))));
+	return _mm_movemask_epi8(m);
+}
+
+// bytes are compared as signed, which is fine since everything above 0x7f
+// is negative and so outside every range checked here
+static inline int sse2_word_mask(__m128i x) {
+	__m128i lower = _mm_or_si128(x, _mm_set1_epi8(0x20));
+	__m128i letter = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+			_mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+	__m128i digit = _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8('0' - 1)),
+			_mm_cmplt_epi8(x, _mm_set1_epi8('9' + 1)));
+	__m128i under = _mm_cmpeq_epi8(x, _mm_set1_epi8('_'));
+	return _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(letter, digit), under));
+}
+
+static inline int sse2_comment_mask(__m128i x) {
+	__m128i m = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('/')), _mm_cmpeq_epi8(x, _mm_set1_epi8('*')));
+	return ~_mm_movemask_epi8(m);
+}
+
+static inline int sse2_line_mask(__m128i x) {
+	return ~_mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8('\n')));
+}
+
+#define SSE2_KERNEL(name) \
+	static const char* sse2_##name(const char* p, const char* end) { \
+		while (end - p >= 16) { \
+			int stop = ~sse2_##name##_mask(_mm_loadu_si128((const __m128i*) p)) & 0xffff; \
+			if (stop != 0) \
+				return p + __builtin_ctz(stop); \
+			p += 16; \
+		} \
+		return scalar_##name(p, end); \
+	}
+
+SSE2_KERNEL(space)
+SSE2_KERNEL(word)
+SSE2_KERNEL(comment)
+SSE2_KERNEL(line)
+
+/*
+ * AVX2, 32 bytes at a time
+ */
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static inline unsigned int avx2_space_mask(__m256i x) {
+	__m256i m = _mm256_or_si256(
+		_mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\t'))),
+		_mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\r'))));
+	return _mm256_movemask_epi8(m);
+}
+
+AVX2 static inline unsigned int avx2_word_mask(__m256i x) {
+	__m256i lower = _mm256_or_si256(x, _mm256_set1_epi8(0x20));
+	__m256i letter = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)),
+			_mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), lower));
+	__m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(x, _mm256_set1_epi8('0' - 1)),
+			_mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), x));
+	__m256i under = _mm256_cmpeq_epi8(x, _mm256_set1_epi8('_'));
+	return _mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(letter, digit), under));
+}
+
+AVX2 static inline unsigned int avx2_comment_mask(__m256i x) {
+	__m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('/')), _mm256_cmpeq_epi8(x, _mm256_set1_epi8('*')));
+	return ~_mm256_movemask_epi8(m);
+}
+
+AVX2 static inline unsigned int avx2_line_mask(__m256i x) {
+	return ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n')));
+}
+
+#define AVX2_KERNEL(name) \
+	AVX2 static const char* avx2_##name(const char* p, const char* end) { \
+		while (end - p >= 32) { \
+			unsigned int stop = ~avx2_##name##_mask(_mm256_loadu_si256((const __m256i*) p)); \
+			if (stop != 0) \
+				return p + __builtin_ctz(stop); \
+			p += 32; \
+		} \
+		return sse2_##name(p, end); \
+	}
+
+AVX2_KERNEL(space)
+AVX2_KERNEL(word)
+AVX2_KERNEL(comment)
+AVX2_KERNEL(line)
+#endif
+
+/*
+ * Dispatch
+ */
+const char* (*scan_space)(const char*, const char*) = scalar_space;
+const char* (*scan_word)(const char*, const char*) = scalar_word;
+const char* (*scan_comment)(const char*, const char*) = scalar_comment;
+const char* (*scan_line)(const char*, const char*) = scalar_line;
+
+// runs before main, so the pointers never change once lexing has started
+__attribute__((constructor)) static void scan_init() {
+#ifdef SCAN_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		scan_space = avx2_space;
+		scan_word = avx2_word;
+		scan_comment = avx2_comment;
+		scan_line = avx2_line;
+	} else if (__builtin_cpu_supports("sse2")) {
+		scan_space = sse2_space;
+		scan_word = sse2_word;
+		scan_comment = sse2_comment;
+		scan_line = sse2_line;
+	}
+#endif
+}
@@ -0,0 +1,110 @@
+#include "source.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Loading
+ */
+// reads everything left in 'fd' into a malloc'd buffer, for pipes and other
+// files that can't be mapped.
+static bool source_read(struct source* s, int fd) {
+	int capacity = 65536;
+	s->data = malloc(capacity);
+	s->size = 0;
+	for (;;) {
+		if (s->size == capacity)
+			s->data = realloc(s->data, capacity *= 2);
+		ssize_t n = read(fd, s->data + s->size, capacity - s->size);
+		if (n < 0) {
+			free(s->data);
+			return false;
+		}
+		if (n == 0)
+			break;
+		s->size += n;
+	}
+	s->mapped = false;
+	return true;
+}
+
+struct source* source_open(const char* filename) {
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	struct source* s = malloc(sizeof(struct source));
+	s->lines = NULL;
+	s->line_count = 0;
+	pthread_mutex_init(&s->lines_lock, NULL);
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		s->data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (s->data != MAP_FAILED) {
+			s->size = st.st_size;
+			s->mapped = true;
+			madvise(s->data, s->size, MADV_SEQUENTIAL);
+			close(fd);
+			return s;
+		}
+	}
+
+	if (!source_read(s, fd)) {
+		free(s);
+		s = NULL;
+	}
+	close(fd);
+	return s;
+}
+
+void source_close(struct source* s) {
+	if (s->mapped)
+		munmap(s->data, s->size);
+	else
+		free(s->data);
+	free(s->lines);
+	pthread_mutex_destroy(&s->lines_lock);
+	free(s);
+}
+
+/*
+ * Positions
+ */
+static void source_index_lines(struct source* s) {
+	int capacity = 1024;
+	int* lines = malloc(sizeof(int) * capacity);
+	lines[s->line_count++] = 0;
+	for (int i = 0; i < s->size; i++) {
+		if (s->data[i] != '\n')
+			continue;
+		if (s->line_count == capacity)
+			lines = realloc(lines, sizeof(int) * (capacity *= 2));
+		lines[s->line_count++] = i + 1;
+	}
+	__atomic_store_n(&s->lines, lines, __ATOMIC_RELEASE);
+}
+
+// converts 'offset' into a 1-based line and column. the line table is only
+// built the first time a position is needed, which is usually an error.
+void source_getpos(struct source* s, int offset, int* line, int* column) {
+	if (__atomic_load_n(&s->lines, __ATOMIC_ACQUIRE) == NULL) {
+		pthread_mutex_lock(&s->lines_lock);
+		if (s->lines == NULL)
+			source_index_lines(s);
+		pthread_mutex_unlock(&s->lines_lock);
+	}
+	int low = 0, high = s->line_count - 1;
+	while (low < high) {
+		int mid = (low + high + 1) / 2;
+		if (s->lines[mid] <= offset)
+			low = mid;
+		else
+			high = mid - 1;
+	}
+	*line = low + 1;
+	*column = offset - s->lines[low] + 1;
+}
@@ -5,70 +5,123 @@
 
 #include "vec.h"
 
-struct sym* sym_alloc(enum sym_type sym_type) {
-	struct sym* s = malloc(sizeof(struct sym));
+struct sym* sym_alloc(struct arena* a, enum sym_type sym_type) {
+	struct sym* s = arena_push(a, sizeof(struct sym));
 	s->sym_type = sym_type;
 	s->param_count = 0;
 	if (s->sym_type == SYM_FUNC) {
 		s->param_capacity = 6;
-		s->params = malloc(s->param_capacity * sizeof(int));
+		s->params = arena_push(a, s->param_capacity * sizeof(int));
 	} else {
 		s->param_capacity = 0;
 	}
+	s->ident = NULL;
 	s->offset = 0;
 	return s;
 }
 
-void sym_add_param(struct sym* s, int type) {
-	if (s->param_count == s->param_capacity)
-		s->params = realloc(s->params, sizeof(int) * (s->param_capacity *= 2));
+void sym_add_param(struct arena* a, struct sym* s, int type) {
+	if (s->param_count == s->param_capacity) {
+		s->params = arena_resize(a, s->params, sizeof(int) * s->param_capacity,
+				sizeof(int) * s->param_capacity * 2);
+		s->param_capacity *= 2;
+	}
 	s->params[s->param_count++] = type;
 }
 
-void sym_put(struct symtable* st, struct sym* s) {
-	vec_push(st->syms, s);
+/*
+ * Index
+ */
+#define INDEX_THRESHOLD 8
+
+static void symtable_index_put(struct symtable* st, struct sym* s) {
+	int mask = st->bucket_count - 1;
+	int i = s->ident->id & mask;
+	while (st->buckets[i] != NULL) {
+		// an earlier declaration in the same scope wins
+		if (st->buckets[i]->ident == s->ident)
+			return;
+		i = (i + 1) & mask;
+	}
+	st->buckets[i] = s;
 }
 
-struct sym* sym_get(struct symtable* st, const char* name) {
-	while (st != NULL) {
+static void symtable_index_grow(struct symtable* st) {
+	st->bucket_count = st->bucket_count ? st->bucket_count * 2 : 4 * INDEX_THRESHOLD;
+	st->buckets = arena_push(st->arena, st->bucket_count * sizeof(struct sym*));
+	memset(st->buckets, 0, st->bucket_count * sizeof(struct sym*));
+	for (int i = 0; i < st->syms->size; i++) {
+		struct sym* s = st->syms->data[i];
+		if (s->ident != NULL)
+			symtable_index_put(st, s);
+	}
+}
+
+static struct sym* symtable_lookup(struct symtable* st, struct ident* ident) {
+	if (st->buckets == NULL) {
 		for (int i = 0; i < st->syms->size; i++) {
 			struct sym* s = st->syms->data[i];
-			if (!strcmp(name, s->name))
+			if (s->ident == ident)
 				return s;
 		}
-		st = st->parent;
+		return NULL;
+	}
+	int mask = st->bucket_count - 1;
+	for (int i = ident->id & mask; st->buckets[i] != NULL; i = (i + 1) & mask) {
+		if (st->buckets[i]->ident == ident)
+			return st->buckets[i];
 	}
 	return NULL;
 }
 
-int sym_get_last_offset(struct symtable* st) {
-	int offset = 0;
+void sym_put(struct symtable* st, struct sym* s) {
+	s->index = st->syms->size;
+	vec_push(st->syms, s);
+	if (st->buckets == NULL ? st->syms->size > INDEX_THRESHOLD :
+			2 * st->syms->size > st->bucket_count)
+		symtable_index_grow(st);
+	else if (st->buckets != NULL && s->ident != NULL)
+		symtable_index_put(st, s);
+}
+
+// puts local 's' in 'st', giving it the next free slot in the stack frame
+void sym_put_local(struct symtable* st, struct sym* s) {
+	st->offset -= type_getalign(s->type);
+	s->offset = st->offset;
+	if (-st->offset > st->frame->frame_size)
+		st->frame->frame_size = -st->offset;
+	sym_put(st, s);
+}
+
+struct sym* sym_get(struct symtable* st, struct ident* ident) {
 	while (st != NULL) {
-		for (int i = 0; i < st->syms->size; i++) {
-			struct sym* s = st->syms->data[i];
-			if (s->offset < offset)
-				offset = s->offset;
-		}
+		struct sym* s = symtable_lookup(st, ident);
+		if (s != NULL)
+			return s;
 		st = st->parent;
 	}
-	return offset;
+	return NULL;
 }
 
-struct symtable* symtable_alloc(struct symtable* parent) {
-	struct symtable* st = malloc(sizeof(struct symtable));
+struct symtable* symtable_alloc(struct arena* a, struct symtable* parent) {
+	struct symtable* st = arena_push(a, sizeof(struct symtable));
+	st->arena = a;
 	st->parent = parent;
-	st->syms = vec_alloc();
+	st->syms = vec_alloc(a);
+	st->buckets = NULL;
+	st->bucket_count = 0;
+	st->offset = parent != NULL ? parent->offset : 0;
+	st->frame = parent != NULL ? parent->frame : NULL;
+	st->frame_size = 0;
 	return st;
 }
 
-void symtable_free(struct symtable* st) {
-	for (int i = 0; i < st->syms->size; i++) {
-		struct sym* s = st->syms->data[i];
-		if (s->sym_type == SYM_FUNC)
-			free(s->params);
-		free(s);
-	}
-	free(st);
+// allocates the outermost scope of a function, which owns its stack frame
+struct symtable* symtable_alloc_frame(struct arena* a, struct symtable* parent) {
+	struct symtable* st = symtable_alloc(a, parent);
+	st->offset = 0;
+	st->frame = st;
+	return st;
 }
 
 struct symtable* symtable_get_root(struct symtable* st) {
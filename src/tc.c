@@ -0,0 +1,189 @@
+#include "tc.h"
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "context.h"
+#include "gen.h"
+#include "lexer.h"
+#include "parser.h"
+#include "source.h"
+#include "vec.h"
+
+// allocates a context compiling with 'options', or the defaults if NULL
+struct tc_context* tc_alloc(const struct tc_options* options) {
+	struct tc_context* ctx = calloc(1, sizeof(struct tc_context));
+	ctx->options.gen_threads = 1;
+	ctx->options.parse_threads = 1;
+	ctx->options.lex_threads = 1;
+	if (options != NULL)
+		ctx->options = *options;
+	return ctx;
+}
+
+void tc_free(struct tc_context* ctx) {
+	free(ctx);
+}
+
+const char* tc_geterror(struct tc_context* ctx) {
+	return ctx->error;
+}
+
+// records an error at 'offset' in the input, or for the whole file if it
+// is -1, and abandons the compilation
+_Noreturn void tc_verror(struct tc_context* ctx, int offset, const char* format, va_list args) {
+	int n;
+	if (offset >= 0 && ctx->input_source != NULL) {
+		int line, column;
+		source_getpos(ctx->input_source, offset, &line, &column);
+		n = snprintf(ctx->error, sizeof(ctx->error), "%s:%d:%d: error: ",
+				ctx->input_filename, line, column);
+	} else {
+		n = snprintf(ctx->error, sizeof(ctx->error), "%s: error: ", ctx->input_filename);
+	}
+	if (n < (int) sizeof(ctx->error))
+		vsnprintf(ctx->error + n, sizeof(ctx->error) - n, format, args);
+	longjmp(ctx->on_error, 1);
+}
+
+static _Noreturn void error(struct tc_context* ctx, const char* format, ...) {
+	va_list args;
+	va_start(args, format);
+	tc_verror(ctx, -1, format, args);
+}
+
+// releases everything the last compilation left behind, whether or not it
+// got to the end
+static void tc_release(struct tc_context* ctx) {
+	lex_pipe_stop(ctx);
+	gen_release(ctx);
+	if (ctx->input_source != NULL)
+		source_close(ctx->input_source);
+	if (ctx->output_file != NULL)
+		fclose(ctx->output_file);
+	if (ctx->lex_arena != NULL)
+		arena_free(ctx->lex_arena);
+	if (ctx->parse_arena != NULL)
+		arena_free(ctx->parse_arena);
+	if (ctx->func_arena != NULL)
+		arena_free(ctx->func_arena);
+	if (ctx->ident_arena != NULL)
+		arena_free(ctx->ident_arena);
+	if (ctx->gen_arena != NULL)
+		arena_free(ctx->gen_arena);
+	free(ctx->ident_table);
+	for (int i = 0; i < ctx->worker_arena_count; i++)
+		arena_free(ctx->worker_arenas[i]);
+	free(ctx->worker_arenas);
+
+	// everything but the options and the error message starts over
+	struct tc_options options = ctx->options;
+	char error[sizeof(ctx->error)];
+	memcpy(error, ctx->error, sizeof(error));
+	memset(ctx, 0, sizeof(struct tc_context));
+	ctx->options = options;
+	memcpy(ctx->error, error, sizeof(error));
+}
+
+// closes the finished 'output' and reports on the compilation, which
+// started at 'start'
+static int tc_finish(struct tc_context* ctx, const char* output, struct trace_time* start) {
+	trace_switch(ctx, PHASE_OTHER);
+	if (fclose(ctx->output_file) != 0) {
+		ctx->output_file = NULL;
+		remove(output);
+		error(ctx, "couldn't write '%s'.\n", output);
+	}
+	ctx->output_file = NULL;
+	lex_pipe_stop(ctx);
+	trace_report(ctx);
+	trace_end(ctx, start, "file", ctx->input_filename);
+	tc_release(ctx);
+	return 0;
+}
+
+// compiles 'input' into 'output'. returns 0 on success; otherwise the
+// message is left in tc_geterror() and 'output' is removed.
+int tc_compile(struct tc_context* ctx, const char* input, const char* output) {
+	tc_release(ctx);
+	ctx->error[0] = '\0';
+	ctx->input_filename = input;
+	ctx->output_filename = output;
+	if (setjmp(ctx->on_error)) {
+		bool created = ctx->output_file != NULL;
+		tc_release(ctx);
+		if (created)
+			remove(output);
+		return 1;
+	}
+	struct trace_time start;
+	trace_begin(ctx, &start);
+	ctx->phase = PHASE_COUNT;
+	trace_switch(ctx, PHASE_OTHER);
+
+	ctx->input_source = source_open(input);
+	if (ctx->input_source == NULL)
+		error(ctx, "couldn't open file for reading.\n");
+	ctx->output_file = fopen(output, "w");
+	if (ctx->output_file == NULL)
+		error(ctx, "couldn't open '%s' for writing.\n", output);
+
+	ctx->lex_arena = arena_alloc();
+	ctx->parse_arena = arena_alloc();
+	ctx->func_arena = arena_alloc();
+	ctx->ident_arena = arena_alloc();
+	ctx->gen_arena = arena_alloc();
+
+	// To lex or parse on several threads, or to skip unused functions, the
+	// whole file is lexed first, holding back asm blocks until the functions
+	// before them have been written
+	if (ctx->options.parse_threads > 1 || ctx->options.lex_threads > 1 || ctx->options.lazy) {
+		ctx->asm_blocks = vec_alloc(ctx->lex_arena);
+		trace_switch(ctx, PHASE_LEX);
+		struct trace_time lex_start;
+		trace_begin(ctx, &lex_start);
+		struct tokens* ts = ctx->options.lex_threads > 1 ?
+			lex_parallel(ctx, ctx->lex_arena, ctx->options.lex_threads) : lex(ctx, ctx->lex_arena);
+		trace_end(ctx, &lex_start, "lex", "lex");
+
+		trace_switch(ctx, PHASE_PARSE);
+		void (*emit)(struct tc_context*, struct func*) = gen_func;
+		if (ctx->options.gen_threads > 1) {
+			gen_begin(ctx);
+			emit = gen_queue;
+		}
+		struct lib* l = ctx->options.lazy ?
+			parse_lazy(ctx, ts, ctx->parse_arena, ctx->options.parse_threads, ctx->options.roots, emit) :
+			parse_parallel(ctx, ts, ctx->parse_arena, ctx->options.parse_threads, emit);
+		trace_switch(ctx, PHASE_GEN);
+		gen(ctx, l);
+		if (ctx->options.gen_threads > 1)
+			gen_flush(ctx, ctx->options.gen_threads);
+		return tc_finish(ctx, output, &start);
+	}
+
+	// Otherwise the parser pulls tokens from the lexer as it goes and hands
+	// each function to the code generator as soon as it is complete, so only
+	// a few tokens and one function's tree are ever kept. To generate on
+	// several threads the trees are all kept and generated at the end.
+	// Lexing on demand is charged to parsing in the time report
+	trace_switch(ctx, PHASE_PARSE);
+	struct tokens* ts = ctx->options.lex_thread ? lex_pipe(ctx, ctx->lex_arena, PARSE_WINDOW) :
+		lex_stream(ctx, ctx->lex_arena, PARSE_WINDOW);
+	if (ctx->options.gen_threads > 1) {
+		gen_begin(ctx);
+		struct lib* l = parse_stream(ctx, ts, ctx->parse_arena, NULL, gen_queue);
+		trace_switch(ctx, PHASE_GEN);
+		gen(ctx, l);
+		gen_flush(ctx, ctx->options.gen_threads);
+	} else {
+		struct lib* l = parse_stream(ctx, ts, ctx->parse_arena, ctx->func_arena, gen_func);
+		trace_switch(ctx, PHASE_GEN);
+		gen(ctx, l);
+	}
+	return tc_finish(ctx, output, &start);
+}
@@ -4,29 +4,86 @@
 #include <stdlib.h>
 #include <string.h>
 
+
 static const char* token_type_str[] = {
 	"extern", "var", "fn", "return",
 	"if", "else", "while",
-	"sizeof",
+	"sizeof", "asm",
 
 	">>=", "<<=", "+=", "-=",
 	"*=", "/=", "&=", "|=",
 	">>", "<<", "++", "--", "&&",
 	"||", "<=", ">=", "==", "!=",
 
-	"'NUMBER", "'TYPE", "'NAME", "'EOF",
+	"'NUMBER", "'STRING", "'TYPE", "'NAME", "'EOF",
 };
 
 int token_type_fromstr(const char* s) {
-	for (int i = 0; i <= T_SIZEOF - T_EXTERN; i++)
+	for (int i = 0; i <= T_ASM - T_EXTERN; i++)
 		if (!strcmp(s, token_type_str[i]))
 			return T_EXTERN + i;
 	return T_EOF;
 }
 
+// returns the size bits for the type name suffix 's' of length 'length', or 0
+static int type_fromsuffix(const char* s, int length) {
+	if (length == 1) {
+		switch (s[0]) {
+			case '0': return TYPE_0;
+			case '1': return TYPE_1;
+			case '8': return TYPE_8;
+		}
+	} else if (s[0] == '1' && s[1] == '6') {
+		return TYPE_16;
+	} else if (s[0] == '3' && s[1] == '2') {
+		return TYPE_32;
+	} else if (s[0] == '6' && s[1] == '4') {
+		return TYPE_64;
+	}
+	return 0;
+}
+
+// classifies the word 's' of length 'length' as a keyword, a type name or a
+// plain name in a single pass, switching on the length and then on the
+// characters that tell the candidates apart. for type names, the type is
+// stored in 'type'.
+int token_type_fromword(const char* s, int length, int* type) {
+	if ((length == 2 || length == 3) && (s[0] == 's' || s[0] == 'u')) {
+		int size = type_fromsuffix(s + 1, length - 1);
+		if (size != 0) {
+			*type = s[0] == 's' ? size | TYPE_SIGNED : size;
+			return T_TYPE;
+		}
+	}
+	switch (length) {
+		case 2:
+			if (s[0] == 'f' && s[1] == 'n') return T_FN;
+			if (s[0] == 'i' && s[1] == 'f') return T_IF;
+			break;
+		case 3:
+			if (s[0] == 'v' && s[1] == 'a' && s[2] == 'r') return T_VAR;
+			if (s[0] == 'a' && s[1] == 's' && s[2] == 'm') return T_ASM;
+			break;
+		case 4:
+			if (!memcmp(s, "else", 4)) return T_ELSE;
+			break;
+		case 5:
+			if (!memcmp(s, "while", 5)) return T_WHILE;
+			break;
+		case 6:
+			switch (s[0]) {
+				case 'e': if (!memcmp(s, "extern", 6)) return T_EXTERN; break;
+				case 'r': if (!memcmp(s, "return", 6)) return T_RETURN; break;
+				case 's': if (!memcmp(s, "sizeof", 6)) return T_SIZEOF; break;
+			}
+			break;
+	}
+	return T_NAME;
+}
+
 const char* token_type_tostr(int t) {
 	if (t < T_EXTERN) {
-		static char buffer[2] = { 0 };
+		static _Thread_local char buffer[2] = { 0 };
 		buffer[0] = t;
 		return buffer;
 	} else if (t < T_NUMBER) {
@@ -37,15 +94,77 @@ const char* token_type_tostr(int t) {
 	return "?";
 }
 
+struct tokens* tokens_alloc(struct arena* a) {
+	struct tokens* ts = arena_push(a, sizeof(struct tokens));
+	ts->arena = a;
+	ts->count = ts->value_count = 0;
+	ts->capacity = ts->value_capacity = 1024;
+	ts->mask = ts->value_mask = -1;
+	ts->kinds = arena_push(a, ts->capacity);
+	ts->offsets = arena_push(a, ts->capacity * sizeof(int));
+	ts->values = arena_push(a, ts->value_capacity * sizeof(union token_value));
+	ts->pull = NULL;
+	ts->ctx = NULL;
+	return ts;
+}
+
+// allocates a ring buffer that keeps at least the last 'window' tokens and
+// reads new ones from 'pull' on demand, so its size doesn't depend on the
+// input.
+struct tokens* tokens_alloc_ring(struct arena* a, int window,
+		void (*pull)(struct tc_context*, struct token*), struct tc_context* ctx) {
+	int size = 1;
+	while (size < window)
+		size *= 2;
+	struct tokens* ts = arena_push(a, sizeof(struct tokens));
+	ts->arena = a;
+	ts->count = ts->value_count = 0;
+	ts->capacity = ts->value_capacity = size;
+	ts->mask = ts->value_mask = size - 1;
+	ts->kinds = arena_push(a, size);
+	ts->offsets = arena_push(a, size * sizeof(int));
+	ts->values = arena_push(a, size * sizeof(union token_value));
+	ts->pull = pull;
+	ts->ctx = ctx;
+	return ts;
+}
+
+void tokens_push(struct tokens* ts, struct token* t) {
+	if (ts->count == ts->capacity && ts->mask == -1) {
+		ts->kinds = arena_resize(ts->arena, ts->kinds, ts->capacity, ts->capacity * 2);
+		ts->offsets = arena_resize(ts->arena, ts->offsets,
+				ts->capacity * sizeof(int), ts->capacity * 2 * sizeof(int));
+		ts->capacity *= 2;
+	}
+	ts->kinds[ts->count & ts->mask] = t->token;
+	ts->offsets[ts->count++ & ts->mask] = t->offset;
+	if (!token_hasvalue(t->token))
+		return;
+
+	if (ts->value_count == ts->value_capacity && ts->value_mask == -1) {
+		ts->values = arena_resize(ts->arena, ts->values,
+				ts->value_capacity * sizeof(union token_value),
+				ts->value_capacity * 2 * sizeof(union token_value));
+		ts->value_capacity *= 2;
+	}
+	union token_value* v = &ts->values[ts->value_count++ & ts->value_mask];
+	switch (t->token) {
+		case T_NUMBER: v->number = t->number; break;
+		case T_STRING: v->length = t->length; break;
+		case T_TYPE: v->type = t->type; break;
+		case T_NAME: v->ident = t->ident; break;
+	}
+}
+
 const char* token_tostr(struct token* t) {
-	static char buffer[21];
+	static _Thread_local char buffer[21];
 	if (t->token == T_NUMBER) {
 		sprintf(buffer, "%ld", t->number);
 		return buffer;
 	} else if (t->token == T_TYPE) {
 		return type_tostr(t->type);
 	} else if (t->token == T_NAME) {
-		return t->name;
+		return t->ident->name;
 	} else if (t->token == T_EOF) {
 		return "EOF";
 	} else {
@@ -0,0 +1,169 @@
+#include "trace.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "arena.h"
+#include "context.h"
+
+static double seconds(clockid_t clock) {
+	struct timespec t;
+	clock_gettime(clock, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+void trace_now(struct trace_time* t) {
+	t->wall = seconds(CLOCK_MONOTONIC);
+	t->cpu = seconds(CLOCK_THREAD_CPUTIME_ID);
+}
+
+/*
+ * Time report
+ */
+// makes 'phase' the one running, charging the time since the last switch
+// to the one before it, and returns that one so it can be switched back to
+int trace_switch(struct tc_context* ctx, int phase) {
+	int old = ctx->phase;
+	ctx->phase = phase;
+	if (ctx->options.time_report == NULL || phase == old)
+		return old;
+	struct trace_time now;
+	trace_now(&now);
+	if (old != PHASE_COUNT) {
+		ctx->phase_times[old].wall += now.wall - ctx->phase_start.wall;
+		ctx->phase_times[old].cpu += now.cpu - ctx->phase_start.cpu;
+	}
+	ctx->phase_start = now;
+	return old;
+}
+
+// charges 'cpu' seconds spent on other threads to the phase running
+void trace_cpu(struct tc_context* ctx, double cpu) {
+	if (ctx->options.time_report != NULL && ctx->phase != PHASE_COUNT)
+		ctx->phase_times[ctx->phase].cpu += cpu;
+}
+
+static size_t arena_allocated(struct arena* a) {
+	return a != NULL ? a->allocated : 0;
+}
+
+// writes where the time of the compilation went, and what it made, to the
+// time report. ends the phase running
+void trace_report(struct tc_context* ctx) {
+	if (ctx->options.time_report == NULL)
+		return;
+	trace_switch(ctx, PHASE_COUNT);
+
+	static const char* names[PHASE_COUNT] = { "other", "lex", "parse", "gen" };
+	struct trace_time total = { 0, 0 };
+	for (int i = 0; i < PHASE_COUNT; i++) {
+		total.wall += ctx->phase_times[i].wall;
+		total.cpu += ctx->phase_times[i].cpu;
+	}
+	size_t allocated = arena_allocated(ctx->lex_arena) + arena_allocated(ctx->parse_arena) +
+		arena_allocated(ctx->func_arena) + arena_allocated(ctx->ident_arena);
+	for (int i = 0; i < ctx->worker_arena_count; i++)
+		allocated += arena_allocated(ctx->worker_arenas[i]);
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+
+	// written at once, so reports from several threads don't mix
+	char* text;
+	size_t size;
+	FILE* f = open_memstream(&text, &size);
+	fprintf(f, "time report for %s\n", ctx->input_filename);
+	fprintf(f, "  %-8s %12s %12s\n", "phase", "wall (ms)", "cpu (ms)");
+	for (int i = 0; i < PHASE_COUNT; i++) {
+		fprintf(f, "  %-8s %12.3f %12.3f %5.1f%%\n", names[i], ctx->phase_times[i].wall * 1e3,
+				ctx->phase_times[i].cpu * 1e3,
+				total.wall > 0 ? 100 * ctx->phase_times[i].wall / total.wall : 0.0);
+	}
+	fprintf(f, "  %-8s %12.3f %12.3f\n", "total", total.wall * 1e3, total.cpu * 1e3);
+	fprintf(f, "  %d tokens, %ld tree nodes, %ld symbols, %d identifiers\n",
+			ctx->tokens != NULL ? ctx->tokens->count : 0, ctx->node_count, ctx->sym_count,
+			ctx->ident_count);
+	fprintf(f, "  %zu bytes in arenas, %ld KiB peak RSS for the process\n", allocated,
+			usage.ru_maxrss);
+	fclose(f);
+	fwrite(text, 1, size, ctx->options.time_report);
+	free(text);
+}
+
+/*
+ * Trace events
+ */
+struct tc_trace {
+	FILE* file;
+	pthread_mutex_t lock;
+	double start;
+	int event_count;
+};
+
+// a small number for each thread, in the order they first trace something
+static atomic_int thread_count;
+static _Thread_local int thread_id;
+
+struct tc_trace* tc_trace_open(const char* path) {
+	FILE* file = fopen(path, "w");
+	if (file == NULL)
+		return NULL;
+	struct tc_trace* trace = malloc(sizeof(struct tc_trace));
+	trace->file = file;
+	pthread_mutex_init(&trace->lock, NULL);
+	trace->start = seconds(CLOCK_MONOTONIC);
+	trace->event_count = 0;
+	fprintf(file, "{\"traceEvents\":[");
+	return trace;
+}
+
+// finishes the trace, returning 0 if all of it was written
+int tc_trace_close(struct tc_trace* trace) {
+	fprintf(trace->file, "\n]}\n");
+	int status = fclose(trace->file) != 0;
+	pthread_mutex_destroy(&trace->lock);
+	free(trace);
+	return status;
+}
+
+static void trace_string(FILE* f, const char* s) {
+	fputc('"', f);
+	for (; *s != '\0'; s++) {
+		if (*s == '"' || *s == '\\')
+			fputc('\\', f);
+		if ((unsigned char) *s >= ' ')
+			fputc(*s, f);
+	}
+	fputc('"', f);
+}
+
+// starts timing an event, if tracing
+void trace_begin(struct tc_context* ctx, struct trace_time* t) {
+	if (ctx->options.trace != NULL)
+		t->wall = seconds(CLOCK_MONOTONIC);
+}
+
+// writes the event started at 't' as a complete event named 'name', in
+// 'category'
+void trace_end(struct tc_context* ctx, struct trace_time* t, const char* category, const char* name) {
+	struct tc_trace* trace = ctx->options.trace;
+	if (trace == NULL)
+		return;
+	double end = seconds(CLOCK_MONOTONIC);
+	if (thread_id == 0)
+		thread_id = atomic_fetch_add(&thread_count, 1) + 1;
+
+	pthread_mutex_lock(&trace->lock);
+	FILE* f = trace->file;
+	fprintf(f, "%s\n{\"name\":", trace->event_count++ ? "," : "");
+	trace_string(f, name);
+	fprintf(f, ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d,"
+			"\"args\":{\"file\":", category, (t->wall - trace->start) * 1e6,
+			(end - t->wall) * 1e6, thread_id);
+	trace_string(f, ctx->input_filename);
+	fprintf(f, "}}");
+	pthread_mutex_unlock(&trace->lock);
+}
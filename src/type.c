@@ -28,7 +28,7 @@ int type_fromint(long n) {
 }
 
 char* type_tostr(int t) {
-	static char buffer[128];
+	static _Thread_local char buffer[128];
 	int index = sprintf(buffer, type_issigned(t) ? "s" : "u");
 	switch (type_gettype(t)) {
 		case TYPE_0: index += sprintf(buffer + index, "0"); break;
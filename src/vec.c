@@ -2,21 +2,30 @@
 
 #include <stdlib.h>
 
-struct vec *vec_alloc() {
-	struct vec *v = malloc(sizeof(struct vec));
+// allocates a vector in 'a', or on the heap if 'a' is NULL
+struct vec *vec_alloc(struct arena *a) {
+	struct vec *v = a ? arena_push(a, sizeof(struct vec)) : malloc(sizeof(struct vec));
+	v->arena = a;
 	v->capacity = 16;
 	v->size = 0;
-	v->data = malloc(sizeof(void*) * v->capacity);
+	v->data = a ? arena_push(a, sizeof(void*) * v->capacity) : malloc(sizeof(void*) * v->capacity);
 	return v;
 }
 
 void vec_free(struct vec *v) {
+	if (v->arena)
+		return;
 	free(v->data);
 	free(v);
 }
 
 void vec_push(struct vec *v, void *e) {
-	if (v->size == v->capacity)
-		v->data = realloc(v->data, sizeof(void*) * (v->capacity *= 2));
+	if (v->size == v->capacity) {
+		if (v->arena)
+			v->data = arena_resize(v->arena, v->data, sizeof(void*) * v->capacity, sizeof(void*) * v->capacity * 2);
+		else
+			v->data = realloc(v->data, sizeof(void*) * v->capacity * 2);
+		v->capacity *= 2;
+	}
 	v->data[v->size++] = e;
 }